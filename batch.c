@@ -0,0 +1,315 @@
+/*
+ * batch.c
+ *
+ * Interleaved batch evaluation. Each lane evaluates one tree with an
+ * explicit stack of frames instead of recursion, so it can stop after
+ * any step and carry on later. A step only touches memory the lane
+ * prefetched in its last step (or that is probably cached anyway), then
+ * prefetches what its next step will read and hands over to the next
+ * lane. With enough lanes, a prefetch has finished by the time its lane
+ * comes round again.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "batch.h"
+#include "symtab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOOKUP_RUN 8            // symbols a lane compares in one step
+
+// Where a frame is in evaluating its node
+typedef enum frame_state_e {
+	FRAME_ENTER,            // the node has been prefetched
+	FRAME_DISPATCH,         // its interior or leaf part has been prefetched
+	FRAME_LOOKUP,           // searching the symbol list, at symbol
+	FRAME_LEFT,             // the left operand is being evaluated
+	FRAME_RIGHT,            // the right operand is being evaluated
+	FRAME_TEST,             // the test of a ?: is being evaluated
+	FRAME_CHOOSE,           // the alternatives of a ?: have been prefetched
+	FRAME_ASSIGN            // the value to assign is being evaluated
+} frame_state_t;
+
+// One node being evaluated, what a call to eval_tree would be
+typedef struct frame_s {
+	tree_node_t *node;      // the node
+	frame_state_t state;    // how far it has got
+	int left_val;           // the value of the left operand or test
+	symbol_t *symbol;       // the next symbol to compare (FRAME_LOOKUP)
+} frame_t;
+
+// One tree in flight
+typedef struct lane_s {
+	int busy;               // whether it has a tree
+	size_t tree;            // the index of the tree
+	frame_t *frames;        // the frames, innermost last
+	size_t depth;           // the number of frames
+	size_t cap;             // the allocated number of frames
+	int ret;                // the value of the frame popped last
+} lane_t;
+
+// What a step did
+typedef enum step_e {
+	STEP_RUNNING,           // the tree is not done yet
+	STEP_DONE,              // the tree is done, ret is its value
+	STEP_FAILED             // the tree is done, with an error
+} step_t;
+
+// A batch being evaluated
+typedef struct batch_s {
+	lane_t *lanes;          // the lanes
+	int width;              // the number of lanes
+	int active;             // the number of busy lanes
+	size_t next;            // the next tree to start
+	lane_t *barrier;        // the lane that is assigning, or NULL; no tree starts until it is done
+	eval_error_t error;     // the error of the last step that failed
+} batch_t;
+
+/// Starts evaluating a node in a lane
+///
+/// @param lane The lane
+/// @param node The node
+static void push(lane_t *lane, tree_node_t *node) {
+	if (lane->depth == lane->cap) {
+		lane->cap = lane->cap ? lane->cap * 2 : 64;
+		frame_t *bigger = (frame_t *) realloc(lane->frames, lane->cap * sizeof(frame_t));
+		if (bigger == NULL) { // Check if realloc failed
+			fprintf(stderr, "Error: batch memory allocation failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		lane->frames = bigger;
+	}
+	__builtin_prefetch(node);
+	frame_t *frame = &lane->frames[lane->depth++];
+	frame->node = node;
+	frame->state = FRAME_ENTER;
+}
+
+/// Finishes the innermost frame of a lane
+///
+/// @param lane The lane
+/// @param val The value of its node
+/// @return STEP_DONE if it was the root, STEP_RUNNING otherwise
+static step_t pop(lane_t *lane, int val) {
+	lane->ret = val;
+	lane->depth--;
+	return lane->depth == 0 ? STEP_DONE : STEP_RUNNING;
+}
+
+/// Ends a lane's tree with an error
+///
+/// @param batch The batch
+/// @param error The error eval_tree would have reported
+/// @return STEP_FAILED
+static step_t fail(batch_t *batch, eval_error_t error) {
+	batch->error = error;
+	return STEP_FAILED;
+}
+
+/// Gets a lane ready to assign, which it may only do once every older
+/// tree is done and no younger one has read the table
+///
+/// @param batch The batch
+/// @param lane The lane
+/// @return 1 if it may assign now, 0 if it has to wait
+static int claim_assign(batch_t *batch, lane_t *lane) {
+	if (batch->barrier != lane) {
+		// Younger trees may have read what is about to change, so they start over
+		for (int i = 0; i < batch->width; i++) {
+			lane_t *other = &batch->lanes[i];
+			if (other->busy && other->tree > lane->tree) {
+				other->busy = 0;
+				batch->active--;
+			}
+		}
+		batch->next = lane->tree + 1;
+		batch->barrier = lane;
+	}
+	return batch->active == 1; // Only older trees are left, and they have to finish first
+}
+
+/// Takes one step of the tree in a lane
+///
+/// @param batch The batch
+/// @param lane The lane
+/// @return What became of the tree
+static step_t step(batch_t *batch, lane_t *lane) {
+	frame_t *frame = &lane->frames[lane->depth - 1];
+	tree_node_t *node = frame->node;
+
+	switch (frame->state) {
+	case FRAME_ENTER:
+		if (node->type != LEAF && node->type != INTERIOR) {
+			return fail(batch, UNKNOWN_EXP_TYPE);
+		}
+		__builtin_prefetch(node->node);
+		if (node->type == LEAF) {
+			__builtin_prefetch(node->token); // Parsed or compared next
+		}
+		frame->state = FRAME_DISPATCH;
+		return STEP_RUNNING;
+
+	case FRAME_DISPATCH:
+		if (node->type == LEAF) {
+			leaf_node_t *leaf = (leaf_node_t *) node->node;
+			if (leaf->exp_type == INTEGER) {
+				return pop(lane, strtol(node->token, NULL, 10));
+			} else if (leaf->exp_type != SYMBOL) {
+				return fail(batch, UNKNOWN_EXP_TYPE);
+			}
+			frame->symbol = newest_symbol();
+			if (frame->symbol != NULL) {
+				__builtin_prefetch(frame->symbol);
+			}
+			frame->state = FRAME_LOOKUP;
+			return STEP_RUNNING;
+		}
+
+		interior_node_t *interior = (interior_node_t *) node->node;
+		if (interior->op == ASSIGN_OP) {
+			if (interior->left->type != LEAF || ((leaf_node_t *) interior->left->node)->exp_type != SYMBOL) {
+				return fail(batch, INVALID_LVALUE);
+			}
+			frame->state = FRAME_ASSIGN;
+			push(lane, interior->right);
+		} else if (interior->op == Q_OP) {
+			__builtin_prefetch(interior->right); // Holds the alternatives
+			frame->state = FRAME_TEST;
+			push(lane, interior->left);
+		} else {
+			__builtin_prefetch(interior->right); // Needed right after the left operand
+			frame->state = FRAME_LEFT;
+			push(lane, interior->left);
+		}
+		return STEP_RUNNING;
+
+	case FRAME_LOOKUP:
+		// The list is usually short and cached, so a few at a time
+		for (int i = 0; i < LOOKUP_RUN && frame->symbol != NULL; i++) {
+			if (strcmp(frame->symbol->var_name, node->token) == 0) {
+				return pop(lane, get_symbol_val(frame->symbol));
+			}
+			frame->symbol = frame->symbol->next;
+		}
+		if (frame->symbol != NULL) {
+			__builtin_prefetch(frame->symbol);
+			return STEP_RUNNING;
+		}
+
+		// Not in the list, but a shared or lazily loaded table keeps most symbols elsewhere
+		symbol_t *symbol = lookup_table(node->token);
+		if (symbol == NULL) {
+			return fail(batch, UNDEFINED_SYMBOL);
+		}
+		return pop(lane, get_symbol_val(symbol));
+
+	case FRAME_LEFT:
+		frame->left_val = lane->ret;
+		frame->state = FRAME_RIGHT;
+		push(lane, ((interior_node_t *) node->node)->right);
+		return STEP_RUNNING;
+
+	case FRAME_RIGHT: {
+		int left_val = frame->left_val;
+		int right_val = lane->ret;
+		switch (((interior_node_t *) node->node)->op) {
+			case ADD_OP: return pop(lane, left_val + right_val);
+			case SUB_OP: return pop(lane, left_val - right_val);
+			case MUL_OP: return pop(lane, left_val * right_val);
+			case DIV_OP:
+				if (right_val == 0) {
+					return fail(batch, DIVISION_BY_ZERO);
+				}
+				return pop(lane, left_val / right_val);
+			case MOD_OP:
+				if (right_val == 0) {
+					return fail(batch, DIVISION_BY_ZERO);
+				}
+				return pop(lane, left_val % right_val);
+			default: return fail(batch, UNKNOWN_OPERATION);
+		}
+	}
+
+	case FRAME_TEST:
+		frame->left_val = lane->ret;
+		__builtin_prefetch(((interior_node_t *) node->node)->right->node);
+		frame->state = FRAME_CHOOSE;
+		return STEP_RUNNING;
+
+	case FRAME_CHOOSE: {
+		interior_node_t *alt_node = (interior_node_t *) ((interior_node_t *) node->node)->right->node;
+
+		// The frame becomes the alternative's, whose value is the ?:'s
+		frame->node = frame->left_val ? alt_node->left : alt_node->right;
+		frame->state = FRAME_ENTER;
+		__builtin_prefetch(frame->node);
+		return STEP_RUNNING;
+	}
+
+	case FRAME_ASSIGN:
+		if (!claim_assign(batch, lane)) {
+			return STEP_RUNNING; // Tried again on its next turn
+		}
+		if (bind_symbol(((interior_node_t *) node->node)->left->token, lane->ret) == NULL) {
+			return fail(batch, SYMTAB_FULL); // Only shared tables fill up
+		}
+		return pop(lane, lane->ret);
+	}
+	return fail(batch, UNKNOWN_EXP_TYPE);
+}
+
+/// Evaluates trees as if one after another, several at once
+///
+/// @param roots The roots of the trees
+/// @param count The number of trees
+/// @param width The most trees in flight, 0 for BATCH_WIDTH
+/// @param results Set to the result of each tree
+void batch_eval(tree_node_t **roots, size_t count, int width, batch_result_t *results) {
+	batch_t batch;
+	batch.width = width > 0 ? width : BATCH_WIDTH;
+	batch.active = 0;
+	batch.next = 0;
+	batch.barrier = NULL;
+	batch.error = EVAL_NONE;
+	batch.lanes = (lane_t *) calloc(batch.width, sizeof(lane_t));
+	if (batch.lanes == NULL) { // Check if calloc failed
+		fprintf(stderr, "Error: batch memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Round robin, refilling each lane as its tree finishes
+	while (batch.next < count || batch.active > 0) {
+		for (int i = 0; i < batch.width; i++) {
+			lane_t *lane = &batch.lanes[i];
+			if (!lane->busy) {
+				if (batch.barrier == NULL && batch.next < count) {
+					lane->busy = 1;
+					lane->tree = batch.next++;
+					lane->depth = 0;
+					push(lane, roots[lane->tree]);
+					batch.active++;
+				}
+				continue;
+			}
+
+			step_t done = step(&batch, lane);
+			if (done == STEP_RUNNING) {
+				continue;
+			}
+			results[lane->tree].value = done == STEP_DONE ? lane->ret : -1;
+			results[lane->tree].error = done == STEP_DONE ? EVAL_NONE : batch.error;
+			lane->busy = 0;
+			batch.active--;
+			if (batch.barrier == lane) {
+				batch.barrier = NULL; // Its assignments are done, so the rest can go on
+			}
+		}
+	}
+
+	for (int i = 0; i < batch.width; i++) {
+		free(batch.lanes[i].frames);
+	}
+	free(batch.lanes);
+}
@@ -0,0 +1,43 @@
+/// Interleaved evaluation of batches of parse trees
+///
+/// eval_tree follows one pointer after another, so on a tree that is
+/// not in the cache it waits on a miss at almost every node.  batch_eval
+/// evaluates many trees at once instead.  Each tree in flight is an
+/// explicit state machine (a lane) with its own stack of frames, and
+/// every step of a lane prefetches the nodes and symbols its next step
+/// will read before the next lane gets a turn, so the misses of all the
+/// lanes overlap instead of following one another.
+///
+/// The results are exactly what evaluating the trees one after another
+/// with eval_tree gives.  Trees that only read the symbol table can be
+/// evaluated in any order, but assignments can not: a lane about to
+/// assign waits until every older tree is done, throws away the work
+/// on every younger tree (which may have read the old value) and then
+/// runs alone until its tree is done.  So batches where assignments are
+/// common are slower than eval_tree, and the more so the wider they are.
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "parser.h"
+
+#define BATCH_WIDTH 16          // trees in flight when no width is given
+
+// The outcome of evaluating one tree
+typedef struct batch_result_s {
+    int value;                  // the value, or -1 if there was an error
+    eval_error_t error;         // what eval_tree would have reported, or EVAL_NONE
+} batch_result_t;
+
+/// Evaluates trees as if by eval_tree, one after another, but with up
+/// to width of them in flight at once.  Errors are not reported or left
+/// in error_flag; each tree's error is returned instead, for the caller
+/// to pass to eval_fail in order.
+/// @param roots  the roots of the parse trees
+/// @param count  the number of trees
+/// @param width  the most trees in flight, 0 for BATCH_WIDTH
+/// @param results  set to the result of each tree
+void batch_eval(tree_node_t **roots, size_t count, int width, batch_result_t *results);
+
+#endif
@@ -0,0 +1,319 @@
+/*
+ * batch_bench.c
+ *
+ * Builds random parse trees whose nodes are scattered over far more
+ * memory than the last level cache, checks that batch_eval gives the
+ * same values, errors and final symbol table as eval_tree on each tree
+ * in turn, then times both, with batch_eval at several widths.
+ *
+ * usage: batch_bench [millions-of-nodes] [leaves-per-tree] [assignments-per-thousand-trees]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "batch.h"
+#include "symtab.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_SYMBOLS 16
+
+static char names[NUM_SYMBOLS][8];
+
+/// Seconds on the monotonic clock
+///
+/// @return The current time
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// A random number big enough to index millions of nodes
+///
+/// @return The number
+static size_t random_index(void) {
+	return (size_t) rand() << 16 ^ (size_t) rand();
+}
+
+/// Shuffles nodes, so the nodes of a tree end up all over the heap
+///
+/// @param nodes The nodes
+/// @param count The number of nodes
+static void shuffle(tree_node_t **nodes, size_t count) {
+	for (size_t i = count - 1; i > 0; i--) {
+		size_t j = random_index() % (i + 1);
+		tree_node_t *swap = nodes[i];
+		nodes[i] = nodes[j];
+		nodes[j] = swap;
+	}
+}
+
+/// Checks a node was made
+///
+/// @param node The node
+/// @return The node
+static tree_node_t *made(tree_node_t *node) {
+	if (node == NULL) {
+		exit(EXIT_FAILURE); // make_leaf or make_interior said why
+	}
+	return node;
+}
+
+// Nodes made up front, taken in the order they were shuffled into
+typedef struct pool_s {
+	tree_node_t **nodes;
+	size_t count;
+	size_t next;
+} pool_t;
+
+/// Fills a pool with nodes, allocated in a random mix with the other
+/// pool's and then shuffled, so the nodes of a tree end up all over the
+/// heap the way a long session leaves them
+///
+/// @param leaves The pool of leaves
+/// @param interiors The pool of interior nodes (their op is set when they are used)
+static void fill_pools(pool_t *leaves, pool_t *interiors) {
+	leaves->nodes = (tree_node_t **) malloc(leaves->count * sizeof(tree_node_t *));
+	interiors->nodes = (tree_node_t **) malloc(interiors->count * sizeof(tree_node_t *));
+	if (leaves->nodes == NULL || interiors->nodes == NULL) {
+		fprintf(stderr, "Error: benchmark memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t made_leaves = 0;
+	size_t made_interiors = 0;
+	while (made_leaves < leaves->count || made_interiors < interiors->count) {
+		if (made_interiors == interiors->count || (made_leaves < leaves->count && rand() % 2)) {
+			char token[16];
+			snprintf(token, sizeof(token), "%d", rand() % 100);
+			leaves->nodes[made_leaves++] = rand() % 4 == 0 ?
+				made(make_leaf(SYMBOL, names[rand() % NUM_SYMBOLS])) : made(make_leaf(INTEGER, token));
+		} else {
+			interiors->nodes[made_interiors++] = made(make_interior(NO_OP, "op", NULL, NULL));
+		}
+	}
+	shuffle(leaves->nodes, leaves->count);
+	shuffle(interiors->nodes, interiors->count);
+	leaves->next = 0;
+	interiors->next = 0;
+}
+
+/// Links an interior node from the pool
+///
+/// @param interiors The pool
+/// @param op Its operation
+/// @param left Its left operand
+/// @param right Its right operand
+/// @return The node
+static tree_node_t *link_interior(pool_t *interiors, op_type_t op, tree_node_t *left, tree_node_t *right) {
+	tree_node_t *node = interiors->nodes[interiors->next++];
+	interior_node_t *interior = (interior_node_t *) node->node;
+	interior->op = op; // Only leaves' tokens are read when evaluating
+	interior->left = left;
+	interior->right = right;
+	return node;
+}
+
+/// Builds a random tree, shaped like a random binary search tree
+///
+/// @param leaves The pool of leaves
+/// @param interiors The pool of interior nodes
+/// @param count The number of leaves it should have
+/// @return The root
+static tree_node_t *build_tree(pool_t *leaves, pool_t *interiors, size_t count) {
+	static const op_type_t ops[] = { ADD_OP, SUB_OP, MUL_OP };
+	if (count == 1) {
+		return leaves->nodes[leaves->next++];
+	}
+
+	if (count >= 3 && rand() % 8 == 0) {
+		// Laid out like the parser does: test ? (true : false)
+		size_t test = 1 + rand() % (count - 2);
+		size_t when_true = 1 + rand() % (count - test - 1);
+		tree_node_t *test_expr = build_tree(leaves, interiors, test);
+		tree_node_t *true_expr = build_tree(leaves, interiors, when_true);
+		tree_node_t *false_expr = build_tree(leaves, interiors, count - test - when_true);
+		tree_node_t *alt_node = link_interior(interiors, ALT_OP, true_expr, false_expr);
+		return link_interior(interiors, Q_OP, test_expr, alt_node);
+	}
+
+	size_t left = 1 + rand() % (count - 1);
+	tree_node_t *left_expr = build_tree(leaves, interiors, left);
+	tree_node_t *right_expr = build_tree(leaves, interiors, count - left);
+	// Few divisions, or most trees would end up dividing by zero
+	op_type_t op = rand() % 64 == 0 ? (rand() % 2 ? DIV_OP : MOD_OP) : ops[rand() % 3];
+	return link_interior(interiors, op, left_expr, right_expr);
+}
+
+/// Sets every symbol back to its starting value
+static void reset_symbols(void) {
+	for (int i = 0; i < NUM_SYMBOLS; i++) {
+		set_symbol_val(lookup_table(names[i]), i + 1);
+	}
+}
+
+/// Redirects standard error, so error messages cost what they would
+/// without filling the terminal
+///
+/// @param fd The descriptor to send it to
+/// @return The descriptor it went to before
+static int redirect_stderr(int fd) {
+	fflush(stderr);
+	int saved = dup(STDERR_FILENO);
+	dup2(fd, STDERR_FILENO);
+	return saved;
+}
+
+/// Evaluates every tree in turn with eval_tree
+///
+/// @param trees The roots
+/// @param count The number of trees
+/// @param results Set to the value of each tree, and whether it failed
+static void eval_sequential(tree_node_t **trees, size_t count, batch_result_t *results) {
+	for (size_t i = 0; i < count; i++) {
+		results[i].value = eval_tree(trees[i]);
+		results[i].error = error_flag ? UNKNOWN_EXP_TYPE : EVAL_NONE; // eval_tree only says that it failed
+		error_flag = 0;
+	}
+}
+
+/// Evaluates the trees with batch_eval and reports their errors in order
+///
+/// @param trees The roots
+/// @param count The number of trees
+/// @param width The number of lanes
+/// @param results Set to the result of each tree
+static void eval_batched(tree_node_t **trees, size_t count, int width, batch_result_t *results) {
+	batch_eval(trees, count, width, results);
+	for (size_t i = 0; i < count; i++) {
+		if (results[i].error != EVAL_NONE) {
+			eval_fail(results[i].error);
+			error_flag = 0;
+		}
+	}
+}
+
+/// Entry point of the benchmark
+///
+/// @param argc The number of command line arguments
+/// @param argv The command line arguments
+/// @return EXIT_SUCCESS if every result matched, EXIT_FAILURE otherwise
+int main(int argc, char *argv[]) {
+	double millions = argc > 1 ? atof(argv[1]) : 4;
+	size_t leaves = argc > 2 ? (size_t) atol(argv[2]) : 256;
+	int assign_rate = argc > 3 ? atoi(argv[3]) : 1;
+	if (leaves < 1) {
+		leaves = 1;
+	}
+	size_t count = (size_t) (millions * 1e6 / (2 * leaves));
+	if (count < 1) {
+		count = 1;
+	}
+
+	srand(37);
+	for (int i = 0; i < NUM_SYMBOLS; i++) {
+		snprintf(names[i], sizeof(names[i]), "s%d", i);
+		create_symbol(names[i], i + 1);
+	}
+
+	// Each tree needs leaves - 1 interior nodes, and one more if it assigns
+	pool_t leaf_pool = { NULL, count * leaves, 0 };
+	pool_t interior_pool = { NULL, count * leaves, 0 };
+	fill_pools(&leaf_pool, &interior_pool);
+	tree_node_t **trees = (tree_node_t **) malloc(count * sizeof(tree_node_t *));
+	batch_result_t *expect = (batch_result_t *) malloc(count * sizeof(batch_result_t));
+	batch_result_t *got = (batch_result_t *) malloc(count * sizeof(batch_result_t));
+	int *final_values = (int *) malloc(NUM_SYMBOLS * sizeof(int));
+	if (trees == NULL || expect == NULL || got == NULL || final_values == NULL) {
+		fprintf(stderr, "Error: benchmark memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t assigns = 0;
+	for (size_t t = 0; t < count; t++) {
+		trees[t] = build_tree(&leaf_pool, &interior_pool, leaves);
+		if (rand() % 1000 < assign_rate) {
+			tree_node_t *target = made(make_leaf(SYMBOL, names[rand() % NUM_SYMBOLS]));
+			trees[t] = link_interior(&interior_pool, ASSIGN_OP, target, trees[t]);
+			assigns++;
+		}
+	}
+	printf("%zu trees of %zu leaves (%zu assign), %zu nodes\n", count, leaves, assigns, leaf_pool.next + interior_pool.next);
+
+	int null_fd = open("/dev/null", O_WRONLY);
+	if (null_fd < 0) {
+		perror("/dev/null");
+		exit(EXIT_FAILURE);
+	}
+
+	// The reference, and the time everything else is measured against
+	double best = 1e9;
+	for (int run = 0; run < 3; run++) {
+		reset_symbols();
+		int saved = redirect_stderr(null_fd);
+		double start = now();
+		eval_sequential(trees, count, expect);
+		double secs = now() - start;
+		redirect_stderr(saved);
+		close(saved);
+		best = secs < best ? secs : best;
+	}
+	double sequential = best;
+	size_t failed = 0;
+	for (size_t i = 0; i < count; i++) {
+		failed += expect[i].error != EVAL_NONE;
+	}
+	for (int i = 0; i < NUM_SYMBOLS; i++) {
+		final_values[i] = get_symbol_val(lookup_table(names[i]));
+	}
+	printf("eval_tree:     %7.1f ns per node (%zu trees failed)\n",
+		sequential / (leaf_pool.next + interior_pool.next) * 1e9, failed);
+
+	int bad = 0;
+	static const int widths[] = { 1, 2, 4, 8, 16, 32, 64 };
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+		best = 1e9;
+		int mismatches = 0;
+		for (int run = 0; run < 3; run++) {
+			reset_symbols();
+			int saved = redirect_stderr(null_fd);
+			double start = now();
+			eval_batched(trees, count, widths[w], got);
+			double secs = now() - start;
+			redirect_stderr(saved);
+			close(saved);
+			best = secs < best ? secs : best;
+
+			for (size_t i = 0; i < count; i++) {
+				mismatches += got[i].value != expect[i].value ||
+					(got[i].error != EVAL_NONE) != (expect[i].error != EVAL_NONE);
+			}
+			for (int i = 0; i < NUM_SYMBOLS; i++) {
+				mismatches += get_symbol_val(lookup_table(names[i])) != final_values[i];
+			}
+		}
+		printf("batch_eval %2d: %7.1f ns per node (%.2fx)%s\n", widths[w],
+			best / (leaf_pool.next + interior_pool.next) * 1e9, sequential / best,
+			mismatches ? " MISMATCH" : "");
+		bad += mismatches;
+	}
+
+	close(null_fd);
+	for (size_t t = 0; t < count; t++) {
+		cleanup_tree(trees[t]);
+	}
+	for (size_t i = interior_pool.next; i < interior_pool.count; i++) {
+		cleanup_tree(interior_pool.nodes[i]); // Left over for assignments that did not happen
+	}
+	free(leaf_pool.nodes);
+	free(interior_pool.nodes);
+	free(trees);
+	free(expect);
+	free(got);
+	free(final_values);
+	free_table();
+	return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,192 @@
+/*
+ * div_bench.c
+ *
+ * Checks fastdiv against / and % on every divisor in a wide range and
+ * on the awkward ones (powers of two, their neighbours, INT_MIN and
+ * INT_MAX), with the awkward dividends, then measures both ways of
+ * dividing by a divisor that is only known at run time: independent
+ * divisions (throughput) and each one waiting on the last (latency).
+ *
+ * usage: div_bench [millions-of-divisions]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "fastdiv.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_VALUES 4096         // dividends in the timing loop (fits in L1)
+
+/// Seconds on the monotonic clock
+///
+/// @return The current time
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// A random int covering the whole range
+///
+/// @return The int
+static int random_int(void) {
+	return (int) ((unsigned) rand() << 17 ^ (unsigned) rand() << 3 ^ (unsigned) rand());
+}
+
+/// Compares fastdiv with / and % for one dividend
+///
+/// @param fd The precomputed divisor
+/// @param n The dividend
+/// @return 1 if they differ, 0 otherwise
+static int check(const fastdiv_t *fd, int n) {
+	int d = fd->d;
+	if (fastdiv_div(fd, n) == n / d && fastdiv_mod(fd, n) == n % d) {
+		return 0;
+	}
+	fprintf(stderr, "Mismatch: %d / %d gave %d %% %d, expected %d %% %d\n", n, d,
+		fastdiv_div(fd, n), fastdiv_mod(fd, n), n / d, n % d);
+	return 1;
+}
+
+/// Compares fastdiv with / and % for one divisor
+///
+/// @param d The divisor
+/// @param randoms How many random dividends to try as well
+/// @return The number of mismatches
+static int check_divisor(int d, int randoms) {
+	static const int edges[] = { INT_MIN, INT_MIN + 1, INT_MIN + 2, -65536, -65535, -3, -2, -1,
+		0, 1, 2, 3, 65535, 65536, INT_MAX - 1, INT_MAX };
+	fastdiv_t fd;
+	int bad = 0;
+	fastdiv_init(&fd, d);
+
+	for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+		bad += check(&fd, edges[i]);
+	}
+
+	// The largest multiples of d and their neighbours, where rounding goes wrong first
+	long long ad = d < 0 ? -(long long) d : d;
+	long long top = ad * (INT_MAX / ad);
+	for (int delta = -1; delta <= 1; delta++) {
+		bad += check(&fd, (int) (top + delta > INT_MAX ? INT_MAX : top + delta));
+		bad += check(&fd, (int) (-top + delta));
+	}
+
+	for (int i = 0; i < randoms; i++) {
+		bad += check(&fd, random_int());
+	}
+	return bad;
+}
+
+/// Checks every divisor that is interesting
+///
+/// @param checked Set to the number of divisors checked
+/// @return The number of mismatches
+static int verify(int *checked) {
+	int bad = 0;
+	*checked = 0;
+
+	for (int d = -100000; d <= 100000; d++) {
+		if (d >= -1 && d <= 1) {
+			continue;
+		}
+		bad += check_divisor(d, 20);
+		(*checked)++;
+	}
+	for (int bit = 2; bit < 31; bit++) {
+		for (int delta = -1; delta <= 1; delta++) {
+			int d = (1 << bit) + delta;
+			bad += check_divisor(d, 2000) + check_divisor(-d, 2000);
+			*checked += 2;
+		}
+	}
+	bad += check_divisor(INT_MIN, 2000) + check_divisor(INT_MAX, 2000) + check_divisor(INT_MIN + 1, 2000);
+	*checked += 3;
+	for (int i = 0; i < 100000; i++) {
+		int d = random_int();
+		if (d >= -1 && d <= 1) {
+			continue;
+		}
+		bad += check_divisor(d, 20);
+		(*checked)++;
+	}
+	return bad;
+}
+
+/// Entry point of the benchmark
+///
+/// @param argc The number of command line arguments
+/// @param argv The command line arguments
+/// @return EXIT_SUCCESS if every result matched, EXIT_FAILURE otherwise
+int main(int argc, char *argv[]) {
+	long long millions = argc > 1 ? atoll(argv[1]) : 200;
+	int checked;
+
+	srand(34);
+	int bad = verify(&checked);
+	printf("verify: %d divisors, %d mismatches\n", checked, bad);
+
+	static int values[NUM_VALUES];
+	for (int i = 0; i < NUM_VALUES; i++) {
+		values[i] = random_int();
+	}
+	long long rounds = millions * 1000000 / NUM_VALUES;
+
+	static const int divisors[] = { 7, -7, 10, 1000, 12345, -65536 };
+	for (int k = 0; k < (int) (sizeof(divisors) / sizeof(divisors[0])); k++) {
+		volatile int hidden = divisors[k]; // Stop the compiler specializing / itself
+		int d = hidden;
+		fastdiv_t fd;
+		fastdiv_init(&fd, d);
+
+		unsigned sum = 0;
+		double start = now();
+		for (long long r = 0; r < rounds; r++) {
+			for (int i = 0; i < NUM_VALUES; i++) {
+				sum += (unsigned) (values[i] / d) + (unsigned) (values[i] % d);
+			}
+		}
+		double idiv = now() - start;
+
+		unsigned fast_sum = 0;
+		start = now();
+		for (long long r = 0; r < rounds; r++) {
+			for (int i = 0; i < NUM_VALUES; i++) {
+				fast_sum += (unsigned) fastdiv_div(&fd, values[i]) + (unsigned) fastdiv_mod(&fd, values[i]);
+			}
+		}
+		double fast = now() - start;
+
+		// The same again with each quotient feeding the next, the way eval uses them
+		int chain = 0;
+		start = now();
+		for (long long r = 0; r < rounds; r++) {
+			for (int i = 0; i < NUM_VALUES; i++) {
+				chain = values[i] - chain / d;
+			}
+		}
+		double idiv_chain = now() - start;
+
+		int fast_chain = 0;
+		start = now();
+		for (long long r = 0; r < rounds; r++) {
+			for (int i = 0; i < NUM_VALUES; i++) {
+				fast_chain = values[i] - fastdiv_div(&fd, fast_chain);
+			}
+		}
+		double fast_chained = now() - start;
+
+		double ops = (double) rounds * NUM_VALUES;
+		printf("d = %6d: independent idiv %5.2f ns, fastdiv %5.2f ns (%.1fx); "
+			"dependent idiv %5.2f ns, fastdiv %5.2f ns (%.1fx)%s\n", d,
+			idiv / ops * 1e9, fast / ops * 1e9, idiv / fast,
+			idiv_chain / ops * 1e9, fast_chained / ops * 1e9, idiv_chain / fast_chained,
+			sum == fast_sum && chain == fast_chain ? "" : " MISMATCH");
+		bad += sum != fast_sum || chain != fast_chain;
+	}
+
+	return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,52 @@
+/*
+ * fastdiv.c
+ *
+ * Magic numbers for signed division by constants, following the
+ * magic() routine of Hacker's Delight (2nd edition, figure 10-1).
+ */
+
+#include "fastdiv.h"
+
+/// Works out the magic numbers for a divisor
+///
+/// @param fd Filled in
+/// @param d The divisor, |d| >= 2
+void fastdiv_init(fastdiv_t *fd, int d) {
+	const unsigned two31 = 0x80000000U;
+	unsigned ad = d < 0 ? 0U - (unsigned) d : (unsigned) d; // |INT_MIN| fits in unsigned
+	unsigned t = two31 + ((unsigned) d >> 31);
+	unsigned anc = t - 1 - t % ad;  // |nc|, the largest multiple of d below 2^31, less one
+	int p = 31;
+	unsigned q1 = two31 / anc;      // 2^p / |nc| and its remainder
+	unsigned r1 = two31 - q1 * anc;
+	unsigned q2 = two31 / ad;       // 2^p / |d| and its remainder
+	unsigned r2 = two31 - q2 * ad;
+	unsigned delta;
+
+	// Find the smallest p for which 2^p / |d| is accurate enough
+	do {
+		p++;
+		q1 *= 2;
+		r1 *= 2;
+		if (r1 >= anc) {
+			q1++;
+			r1 -= anc;
+		}
+		q2 *= 2;
+		r2 *= 2;
+		if (r2 >= ad) {
+			q2++;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+
+	int magic = (int) (q2 + 1);
+	if (d < 0) {
+		magic = (int) (0U - (unsigned) magic);
+	}
+	fd->d = d;
+	fd->magic = magic;
+	fd->shift = p - 32;
+	fd->add = d > 0 && magic < 0 ? 1 : d < 0 && magic > 0 ? -1 : 0;
+}
@@ -0,0 +1,53 @@
+/// Division by a divisor known ahead of time, without a divide instruction
+///
+/// For a divisor d with |d| >= 2 there is a "magic" multiplier M and a
+/// shift s (Hacker's Delight, chapter 10) such that, for every int n,
+///
+///     n / d == ((n * M) >> (32 + s)) corrected toward zero
+///
+/// exactly as C truncates.  Working them out costs about as much as a
+/// few dozen divisions, so it only pays when the same divisor is used
+/// many times; dividing with them is a multiply and a few shifts.
+///
+/// The validator sets one up for each constant divisor, and eval_fast
+/// keeps the ones for symbol divisors by value, so a reassigned symbol
+/// gets its own.  The sweep sets one up for each divisor that can't
+/// change during it.  How much that saves depends on the CPU's divider;
+/// div_bench checks the results against / and % and times both.
+
+#ifndef FASTDIV_H
+#define FASTDIV_H
+
+// A precomputed divisor
+typedef struct fastdiv_s {
+    int d;                      // the divisor, 0 if none is set up
+    int magic;                  // the multiplier M
+    int add;                    // n times this is added to the high product
+    int shift;                  // the extra shift s
+} fastdiv_t;
+
+/// Works out the magic numbers for a divisor
+/// @param fd  filled in
+/// @param d  the divisor, with |d| >= 2 (INT_MIN is fine)
+void fastdiv_init(fastdiv_t *fd, int d);
+
+/// Divides by a precomputed divisor, truncating toward zero like /
+/// @param fd  the divisor
+/// @param n  the dividend
+/// @return n / fd->d
+static inline int fastdiv_div(const fastdiv_t *fd, int n) {
+	int q = (int) (((long long) fd->magic * n) >> 32);
+	q = (int) ((unsigned) q + (unsigned) n * (unsigned) fd->add); // add is -1, 0 or 1
+	q >>= fd->shift;
+	return q + (int) ((unsigned) q >> 31); // Round negative quotients up toward zero
+}
+
+/// Remainder by a precomputed divisor, with the sign of n like %
+/// @param fd  the divisor
+/// @param n  the dividend
+/// @return n % fd->d
+static inline int fastdiv_mod(const fastdiv_t *fd, int n) {
+	return (int) ((unsigned) n - (unsigned) fastdiv_div(fd, n) * (unsigned) fd->d);
+}
+
+#endif
@@ -9,367 +9,536 @@
 
 #include "interp.h"
 #include "symtab.h"
-#include "stack.h"
 #include "tree_node.h"
+#include "tokenize.h"
+#include "parser.h"
+#include "pfc.h"
+#include "sweep.h"
+#include "validate.h"
+#include "wal.h"
+#include "shmtab.h"
+#include "lazytab.h"
+#include "perfctr.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
-static int error_flag = 0; // Global error flag
+static token_list_t tokens = { NULL, 0, 0 }; // Reused for every line
+static int warn = 0; // Print what the validator could not prove (--warn)
+static lazytab_t *lazy_table = NULL; // The table file, if it is loaded on demand (--lazy)
 
-/// Evaluates the given parse tree node
-///
-/// @param node The parse tree node to evaluate
-/// @return The evaluated integer value, or -1 if an error occurs
-int eval(tree_node_t *node) {
-	if (error_flag) {
-        	return -1; // Terminate if an error has occurred
-    	}
-
-    	if (node->type == LEAF) {
-        	leaf_node_t *leaf = (leaf_node_t *) node->node;
-        	if (leaf->exp_type == INTEGER) {
-            		return strtol(node->token, NULL, 10);
-
-        	} else if (leaf->exp_type == SYMBOL) {
-            		symbol_t *symbol = lookup_table(node->token);
-
-            		if (symbol == NULL) {
-                		fprintf(stderr, "Error: Undefined symbol.\n");
-                		error_flag = 1; // Set error flag
-                		return -1;
-            		}
-			return symbol->val;
-        	}
-
-    	} else if (node->type == INTERIOR) {
-        	interior_node_t *interior = (interior_node_t *) node->node;
-
-        	if (interior->op == ASSIGN_OP) {
-            		if (interior->left->type != LEAF || ((leaf_node_t *) interior->left->node)->exp_type != SYMBOL) {
-                		fprintf(stderr, "Error: Invalid l-value.\n");
-                		error_flag = 1; // Set error flag
-                		return -1;
-            		}
-            		int val = eval(interior->right);
+// A dump command (see dump_line)
+typedef struct dump_cmd_s {
+	char *text;             // a copy of the arguments, the fields point into it
+	char *prefix;           // the name or prefix to show
+	int exact;              // prefix is a whole name
+	char *after;            // the name to start after, or NULL
+	unsigned long limit;    // the most to show, 0 for all
+} dump_cmd_t;
 
-			if (error_flag) {
-                		return -1; // Propagate error
-            		}
-
-            		symbol_t *symbol = lookup_table(interior->left->token);
-            		if (symbol == NULL) {
-                		symbol = create_symbol(interior->left->token, val);
-            		} else {
-                		symbol->val = val;
-            		}
-
-            		return val;
-
-        } else if (interior->op == Q_OP) {
-            	int test_val = eval(interior->left);
-		if (error_flag) {
-                	return -1; // Propagate error
-            	}
-            	interior_node_t *alt_node = (interior_node_t *) interior->right->node;
-
-		if (test_val) {
-                	return eval(alt_node->left);
-
-            	} else {
-                	return eval(alt_node->right);
-            	}
-        } else {
-            	int left_val = eval(interior->left);
-
-		if (error_flag) {
-                	return -1; // Propagate error
-            	}
-
-            	int right_val = eval(interior->right);
-
-		if (error_flag) {
-                	return -1; // Propagate error
-            	}
-
-            		switch (interior->op) { // Shoutout SI session for going over these
-                		case ADD_OP: return left_val + right_val;
-                		case SUB_OP: return left_val - right_val;
-                		case MUL_OP: return left_val * right_val;
-                		case DIV_OP:
-					if (right_val == 0) {
-                        			fprintf(stderr, "Error: Division by zero.\n");
-                        			error_flag = 1; // Set error flag
-                        			return -1;
-                    			}
-                    			return left_val / right_val;
-                		case MOD_OP:
-					if (right_val == 0) {
-                        			fprintf(stderr, "Error: Division by zero.\n");
-                        			error_flag = 1; // Set error flag
-                        			return -1;
-                    			}
-                    			return left_val % right_val;
-                		default: fprintf(stderr, "Error: Unknown operation.\n");
-				error_flag = 1; // Set error flag
-				return -1;
-            		}
-        	}
-    	}
-    	fprintf(stderr, "Error: Unkonwn node type.\n");
-	error_flag = 1; // Set error flag
-    	return -1;
+/// Reads the next line of input, however long it is
+///
+/// @param in The stream to read from
+/// @param buffer Where the line is stored (grown by getline)
+/// @param cap The size of buffer
+/// @return 0 at the end of the input, non-zero otherwise
+static int read_line(FILE *in, char **buffer, size_t *cap) {
+	return getline(buffer, cap, in) >= 0;
 }
 
-/// Prints the parse tree with the infix notation - "Easiest part of the assignment"
+/// Strips comments and the newline off of a line
 ///
-/// @param node The parse tree node to print
-void print_infix(tree_node_t *node) {
-    	if (node->type == LEAF) {
-        	printf("%s", node->token);
-
-    	} else if (node->type == INTERIOR) {
-        	interior_node_t *interior = (interior_node_t *)node->node;
-
-        	printf("(");
+/// @param buffer The line to clean up
+/// @return 0 if the whole line is a comment, non-zero otherwise
+static int clean_line(char buffer[]) {
+	// Ignore lines starting with '#'
+	if (buffer[0] == '#') {
+		return 0;
+	}
 
-        	print_infix(interior->left);
-        	printf("%s", node->token);
-        	print_infix(interior->right);
+	// If line has a '#', but not at beginning, ignore everything after it
+	// Assignment receommends usage of "strchr" and replacing '#' with a null byte... clever
+	char * ignore = strchr(buffer, '#'); // Search the buffer for the first #
+	if (ignore) { // If there is a # and ignore is initialized
+		*ignore = '\0';
+	}
 
-        	printf(")");
-    	}
+	// Perform similar action as above to trim off newlines
+	char * newline = strchr(buffer, '\n');
+	if (newline) {
+		*newline = '\0';
+	}
+	return 1;
 }
 
-/// Checks if the given token is an operator
+/// Tokenizes and parses one line
 ///
-/// @param token The token to check
-/// @return 1 if the token is an operator, 0 otherwise
-int is_op(char *token) { // Check if the token is an operation per tree_node.h
-	return (strcmp(token, ADD_OP_STR) == 0 || strcmp(token, SUB_OP_STR) == 0 ||
-           	strcmp(token, MUL_OP_STR) == 0 || strcmp(token, DIV_OP_STR) == 0 ||
-           	strcmp(token, MOD_OP_STR) == 0 || strcmp(token, ASSIGN_OP_STR) == 0 ||
-           	strcmp(token, Q_OP_STR) == 0); // There may be an easier way to do this but KISS right?
+/// @param line The line to parse (every token gets null terminated)
+/// @param num_tokens Set to the number of tokens found
+/// @return The root of the parse tree, or NULL if there were no tokens or an error occurs
+static tree_node_t *parse_line(char line[], size_t *num_tokens) {
+	// Tokenize
+	perf_enter(PERF_TOKENIZE);
+	size_t len = strlen(line);
+	*num_tokens = tokenize(line, len, &tokens);
+	for (size_t i = 0; i < *num_tokens; i++) {
+		line[tokens.tokens[i].start + tokens.tokens[i].len] = '\0'; // Either a space or the end already
+	}
+	perf_leave();
+
+	tree_node_t *root = NULL;
+	parse_error = PARSE_NONE;
+	if (*num_tokens > 0) {
+		perf_enter(PERF_PARSE);
+		root = parse(line, &tokens); // Extra tokens are ignored
+		perf_leave();
+	}
+	return root;
 }
 
-/// Gets the operator type for the given token
+/// Recognizes the scope commands, which must be alone on their line:
 ///
-/// @param token The token to get the operator type for
-/// @return The operator type, or NO_OP if the token is not a valid operator
-op_type_t get_op_type(char *token) {
-	if (strcmp(token, ADD_OP_STR) == 0) {
-		return ADD_OP;
-	} else if (strcmp(token, SUB_OP_STR) == 0) {
-		return SUB_OP;
-	} else if (strcmp(token, MUL_OP_STR) == 0) {
-		return MUL_OP;
-	} else if (strcmp(token, DIV_OP_STR) == 0) {
-		return DIV_OP;
-	} else if (strcmp(token, MOD_OP_STR) == 0) {
-		return MOD_OP;
-    	} else if (strcmp(token, ASSIGN_OP_STR) == 0) {
-		return ASSIGN_OP;
-    	} else if (strcmp(token, Q_OP_STR) == 0) {
-		return Q_OP;
-    	} else {
-		fprintf(stderr, "Error: Unknown operation.\n");
-		error_flag = 1; // Set error flag
-    		return NO_OP;
-	} // In retrospect I think I could've used a switch case and done it better :(
-}
-
-/// Checks if the given token is an integer
+///     .scope push | .scope pop | .scope commit
 ///
-/// @param token The token to check
-/// @return 1 if the token is an integer, 0 otherwise
-int is_int(char *token) { // Check if this token is an int. Only needs to check for positive numbers. Return 0 if not an int, 1 if the token is an int
-	if (isdigit(token[0])) { // Make sure first digit is a number
-		 for (int i = 1; token[i] != '\0'; i++) { // Iterate through and confirm each one is a number
-			if (isdigit(token[i])) {
-				continue;
-			} else {
-				return 0; // Found a non-number
-			}
-		}
+/// No token can start with '.', so they never hide an expression.
+///
+/// @param line The line (without comment or newline)
+/// @param op Set to the command
+/// @return 1 if the line is a scope command, 0 otherwise
+static int scope_line(char line[], scope_op_t *op) {
+	char *word = line + strspn(line, " ");
+	if (strncmp(word, ".scope ", 7) != 0) {
+		return 0;
+	}
+
+	char *action = word + 7 + strspn(word + 7, " ");
+	size_t len = strcspn(action, " ");
+	if (action[len + strspn(action + len, " ")] != '\0') {
+		return 0; // Something after the command, so it is an expression
+	}
+
+	if (len == 4 && strncmp(action, "push", 4) == 0) {
+		*op = SCOPE_PUSH;
+	} else if (len == 3 && strncmp(action, "pop", 3) == 0) {
+		*op = SCOPE_POP;
+	} else if (len == 6 && strncmp(action, "commit", 6) == 0) {
+		*op = SCOPE_COMMIT;
 	} else {
-		return 0; // Found a non-number
+		return 0;
 	}
-	// It must be a number, so return 1
 	return 1;
 }
 
-/// Checks if the given token is a symbol
+/// Runs a scope command
 ///
-/// @param token The token to check
-/// @return 1 if the token is a symbol, 0 otherwise
-int is_symbol(char *token) { // Very similar to above, but for symbols
-	if (isalpha(token[0])) { // Make sure first digit is a letter
-		 for (int i = 1; token[i] != '\0'; i++) { // Iterate through and confirm each one is a letter or number
-			if (isalnum(token[i])) {
-				continue;
-			} else {
-				return 0; // Found non-letter or non-number
-			}
+/// @param op The command
+static void run_scope(scope_op_t op) {
+	if (op == SCOPE_PUSH) {
+		push_scope();
+	} else if (!(op == SCOPE_POP ? pop_scope() : commit_scope())) {
+		fprintf(stderr, "Error: No scope is open.\n"); // Not fatal
+	}
+}
+
+/// Recognizes the dump command, which must be alone on its line:
+///
+///     .dump [name | prefix*] [after name] [limit n]
+///
+/// after and limit may come in either order.  No token can start with
+/// '.', so a symbol named dump is still an expression.
+///
+/// @param line The line (without comment or newline)
+/// @param cmd Filled in with the command (free cmd->text when done)
+/// @return 1 if the line is a dump command, 0 otherwise
+static int dump_line(char line[], dump_cmd_t *cmd) {
+	char *word = line + strspn(line, " ");
+	if (strncmp(word, ".dump", 5) != 0 || (word[5] != ' ' && word[5] != '\0')) {
+		return 0;
+	}
+
+	cmd->text = strdup(word + 5);
+	if (cmd->text == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: dump memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	cmd->prefix = "";
+	cmd->exact = 0;
+	cmd->after = NULL;
+	cmd->limit = 0;
+
+	char *save = NULL;
+	char *arg = strtok_r(cmd->text, " ", &save);
+	if (arg != NULL && strcmp(arg, "after") != 0 && strcmp(arg, "limit") != 0) {
+		size_t len = strlen(arg);
+		cmd->exact = arg[len - 1] != '*';
+		if (!cmd->exact) {
+			arg[--len] = '\0';
 		}
-	} else {
-		return 0; // Found a non-letter or non-number
+		if (strchr(arg, '*') != NULL) {
+			free(cmd->text); // Only a trailing * is allowed
+			return 0;
+		}
+		cmd->prefix = arg;
+		arg = strtok_r(NULL, " ", &save);
+	}
+	while (arg != NULL) { // after and limit, in either order, each at most once
+		char *value = strtok_r(NULL, " ", &save);
+		char *end = NULL;
+		if (strcmp(arg, "after") == 0 && cmd->after == NULL && value != NULL) {
+			cmd->after = value;
+		} else if (strcmp(arg, "limit") == 0 && cmd->limit == 0 && value != NULL && isdigit((unsigned char) value[0]) &&
+			(cmd->limit = strtoul(value, &end, 10)) != 0 && *end == '\0') {
+			// The count is in cmd->limit already
+		} else {
+			break;
+		}
+		arg = strtok_r(NULL, " ", &save);
+	}
+	if (arg != NULL) {
+		free(cmd->text); // Something after the command, so it is an expression
+		return 0;
 	}
-	// It must be a symbol, so return 1
 	return 1;
 }
 
-/// Parses the given stack into a parse tree
+/// Runs a dump command
 ///
-/// @param stack The stack to parse
-/// @return The root of the parse tree, or NULL if an error occurs
-tree_node_t *parse(stack_t *stack) { // Build the parse tree from the stack made in the tokenize function
-    	if (empty_stack(stack)) { // Check if stack is empty
-        	fprintf(stderr, "Error: Stack is empty.\n");
-        	exit(EXIT_FAILURE); // This one is a fatal error
-    	}
-
-    	char *token = (char *) top(stack);
-
-    	pop(stack);
-	// Figure out what kind of token (a+10)>we are dealing with and handle them appropriately
-    	if (is_op(token)) {
-        	op_type_t op = get_op_type(token);
-        	if (op == NO_OP) return NULL; // Non-fatal error
-        	if (op == Q_OP) {
-            		tree_node_t *false_expr = parse(stack);
-            		if (false_expr == NULL) return NULL; // Propagate error
-            		tree_node_t *true_expr = parse(stack);
-            		if (true_expr == NULL) return NULL; // Propagate error
-            		tree_node_t *test_expr = parse(stack);
-            		if (test_expr == NULL) return NULL; // Propagate error
-            		tree_node_t *alt_node = make_interior(ALT_OP, ":", true_expr, false_expr);
-
-            		return make_interior(Q_OP, token, test_expr, alt_node);
-        	} else {
-            		tree_node_t *right = parse(stack);
-            		if (right == NULL) return NULL; // Propagate error
-            		tree_node_t *left = parse(stack);
-            		if (left == NULL) return NULL; // Propagate error
-
-            		return make_interior(op, token, left, right);
-        	}
-    	} else if (is_int(token)) {
-        	return make_leaf(INTEGER, token);
-    	} else if (is_symbol(token)) {
-        	return make_leaf(SYMBOL, token);
-    	} else {
-        	fprintf(stderr, "Error: Illegal token.\n");
-        	error_flag = 1; // Set error flag
-        	return NULL;
-	// I don't think I like parserland
-    	}
+/// @param cmd The command (its text is freed)
+static void run_dump(dump_cmd_t *cmd) {
+	dump_sorted(cmd->prefix, cmd->exact, cmd->after, cmd->limit);
+	free(cmd->text);
 }
 
 void eval_and_print(char line[]) { // Handles tokenizations and some simple valuations that there is no reason to delay on
-	// Tokenize
-	stack_t *tokens = make_stack();
-	int num_tokens = 0;
-
-	char *token = strtok(line, " ");
-	while (token != NULL) {
-		num_tokens++;
-		push(tokens, token);
-		//printf("%s\n", token);
-		token = strtok(NULL, " ");
+	scope_op_t op;
+	if (scope_line(line, &op)) {
+		run_scope(op);
+		printf("> ");
+		return;
+	}
+	dump_cmd_t cmd;
+	if (dump_line(line, &cmd)) {
+		run_dump(&cmd);
+		printf("> ");
+		return;
 	}
 
+	size_t num_tokens;
+	tree_node_t *root = parse_line(line, &num_tokens);
+
 	if (num_tokens > 0) {
-        	tree_node_t *root = parse(tokens);
         	if (root == NULL || error_flag) {
+			if (parse_error == TOO_FEW_TOKENS) {
+				exit(EXIT_FAILURE); // Running out of tokens is fatal
+			}
             		error_flag = 0; // Reset error flag
+			cleanup_tree(root);
+			perf_expr_done();
             		printf("> ");
             		return;
         	}
 
-        	print_infix(root);
-        	int result = eval(root);
+		perf_enter(PERF_PRINT);
+        	print_infix(root); // Before validate_tree, which may read a bad --lazy line
+		perf_leave();
+		perf_enter(PERF_EVAL);
+        	validate_tree(root, warn);
+        	int result = eval_validated(root);
+		perf_leave();
+		perf_enter(PERF_PRINT);
         	if (!error_flag) {
             		printf(" = %d\n", result);
         	}
+		perf_leave();
+		cleanup_tree(root);
+		perf_expr_done(); // Before the prompt, which ends up after the counts
     	} // Always need the >
     	printf("> ");
 }
 
+/// Runs the read-eval-print loop until the end of the input
+///
+/// @param in The stream to read expressions from
+static void repl(FILE *in) {
+	char *buffer = NULL;
+	size_t cap = 0;
+	printf("> ");
+	while (read_line(in, &buffer, &cap)) { // Stdin takes any input from user
+		if (!clean_line(buffer)) {
+			printf("> ");
+			continue;
+		}
+
+		// Read of line complete, send it over to the eval
+		//printf("\"%s\"\n", buffer);
+		eval_and_print(buffer);
+		wal_commit(); // Everything the line changed goes to the log together
+		lazytab_check(lazy_table); // A bad line found in the background is still fatal
+	}
+	free(buffer);
+}
+
+/// Compiles a script into a .pfc image that run_script can replay
+///
+/// @param script The postfix script to compile
+/// @param output The compiled file to write
+static void compile_script(char *script, char *output) {
+	FILE *in = fopen(script, "r");
+	if (in == NULL) { // Check if file open failed
+		perror(script);
+		exit(EXIT_FAILURE);
+	}
+
+	pfc_writer_t *writer = pfc_create(output);
+	char *buffer = NULL;
+	size_t cap = 0;
+	while (read_line(in, &buffer, &cap)) {
+		size_t num_tokens = 0;
+		tree_node_t *root = NULL;
+		scope_op_t op;
+		dump_cmd_t cmd;
+		int command = 0;
+		int dump = 0;
+		if (clean_line(buffer)) {
+			command = scope_line(buffer, &op);
+			dump = !command && dump_line(buffer, &cmd);
+			if (!command && !dump) {
+				root = parse_line(buffer, &num_tokens);
+			}
+		}
+
+		if (command) {
+			pfc_write_scope(writer, op);
+		} else if (dump) {
+			free(cmd.text);
+			pfc_write_dump(writer, buffer + strspn(buffer, " ")); // Run checks it again
+		} else if (num_tokens == 0) {
+			pfc_write_prompt(writer);
+		} else if (root == NULL) {
+			pfc_write_error(writer, parse_error);
+			error_flag = 0;
+			if (parse_error == TOO_FEW_TOKENS) {
+				break; // The interpreter exits here, nothing after it can run
+			}
+		} else {
+			pfc_write_expr(writer, root);
+			cleanup_tree(root);
+		}
+	}
+
+	free(buffer);
+	fclose(in);
+	pfc_close(writer);
+}
+
+/// Runs a compiled script, producing the same output as its text would
+///
+/// @param image The mapped script
+static void run_script(pfc_image_t *image) {
+	pfc_record_t record;
+	printf("> ");
+	while (pfc_next(image, &record)) {
+		if (record.kind == PFC_PARSE_ERROR) {
+			parse_fail(record.error);
+			if (record.error == TOO_FEW_TOKENS) {
+				exit(EXIT_FAILURE); // Running out of tokens is fatal
+			}
+			error_flag = 0; // Reset error flag
+		} else if (record.kind == PFC_SCOPE) {
+			run_scope(record.scope);
+		} else if (record.kind == PFC_DUMP) {
+			char *line = strndup(record.text, record.text_len);
+			dump_cmd_t cmd;
+			if (line == NULL) { // Check if malloc failed
+				fprintf(stderr, "Error: dump memory allocation failed.\n");
+				exit(EXIT_FAILURE);
+			}
+			if (dump_line(line, &cmd)) {
+				run_dump(&cmd);
+			}
+			free(line);
+		} else if (record.kind == PFC_EXPR) {
+			if (error_flag) {
+				error_flag = 0; // Left over from the last expression, same as eval_and_print
+			} else {
+				perf_enter(PERF_PRINT);
+				fwrite(record.infix, 1, record.infix_len, stdout);
+				perf_leave();
+				perf_enter(PERF_EVAL);
+				int result = pfc_eval(record.code);
+				perf_leave();
+				perf_enter(PERF_PRINT);
+				if (!error_flag) {
+					printf(" = %d\n", result);
+				}
+				perf_leave();
+			}
+		}
+		wal_commit();
+		lazytab_check(lazy_table);
+		if (record.kind == PFC_EXPR || record.kind == PFC_PARSE_ERROR) {
+			perf_expr_done(); // Compiled, so nothing was tokenized or parsed
+		}
+		printf("> ");
+	}
+}
+
+/// Prints how to run the program
+static void usage(void) {
+	fprintf(stderr, "Usage: interp [sym-table] [--warn] [--no-dump] [--perf-counters] [--run script.pfc] [--wal dir [--checkpoint n] | --shm name | --lazy]\n");
+	fprintf(stderr, "       interp --compile script.pf -o script.pfc\n");
+	fprintf(stderr, "       interp [sym-table [--lazy]] --sweep 'x=lo..hi,...' 'expr' [--threads n]\n");
+}
+
 /// The main function of the interpreter program
 ///
 /// @param argc The number of command line arguments
 /// @param argv The command line arguments
 /// @return EXIT_SUCCESS if no error, or EXIT_FAILURE on a (fatal)error
 int main(int argc, char *argv[]) {
-	if (argc > 2) {
-		fprintf(stderr, "Usage: interp [sym-table]\n");
+	char *table = NULL;
+	char *compile = NULL;
+	char *output = NULL;
+	char *run = NULL;
+	char *sweep_spec = NULL;
+	char *sweep_expr = NULL;
+	int threads = 0;
+	int no_dump = 0;
+	int lazy = 0;
+	int perf_counters = 0;
+	char *wal_dir = NULL;
+	char *shm_name = NULL;
+	unsigned long long checkpoint_every = WAL_CHECKPOINT_RECORDS;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--compile") == 0 && i + 1 < argc) {
+			compile = argv[++i];
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output = argv[++i];
+		} else if (strcmp(argv[i], "--run") == 0 && i + 1 < argc) {
+			run = argv[++i];
+		} else if (strcmp(argv[i], "--sweep") == 0 && i + 2 < argc) {
+			sweep_spec = argv[++i];
+			sweep_expr = argv[++i];
+		} else if (strcmp(argv[i], "--wal") == 0 && i + 1 < argc) {
+			wal_dir = argv[++i];
+		} else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+			shm_name = argv[++i];
+		} else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+			checkpoint_every = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--warn") == 0) {
+			warn = 1;
+		} else if (strcmp(argv[i], "--no-dump") == 0) {
+			no_dump = 1;
+		} else if (strcmp(argv[i], "--lazy") == 0) {
+			lazy = 1;
+		} else if (strcmp(argv[i], "--perf-counters") == 0) {
+			perf_counters = 1;
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+			threads = atoi(argv[++i]);
+		} else if (argv[i][0] == '-' || table != NULL) {
+			usage();
+			return EXIT_FAILURE; // Fatal error
+		} else {
+			table = argv[i];
+		}
+	}
+
+	if (compile != NULL || output != NULL) {
+		if (compile == NULL || output == NULL || table != NULL || run != NULL || wal_dir != NULL ||
+			shm_name != NULL || lazy || perf_counters) {
+			usage();
+			return EXIT_FAILURE; // Fatal error
+		}
+		compile_script(compile, output);
+		return EXIT_SUCCESS;
+	}
+
+	if (wal_dir != NULL && shm_name != NULL) {
+		usage(); // The log can't see what other processes change
 		return EXIT_FAILURE; // Fatal error
+	}
+	if (lazy && (wal_dir != NULL || shm_name != NULL)) {
+		usage(); // Both of those load the whole table themselves
+		return EXIT_FAILURE; // Fatal error
+	}
 
-	} else if (argc == 2) {
-		//printf("Building table.\n");
-		build_table(argv[1]);
-		//printf("Dumping table.\n");
-		dump_table();
+	if (sweep_spec != NULL) {
+		if (run != NULL || wal_dir != NULL || perf_counters) {
+			usage(); // --perf-counters would miss the worker threads
+			return EXIT_FAILURE; // Fatal error
+		}
+		if (shm_name != NULL) {
+			attach_shared_table(shm_name, table);
+		} else if (table != NULL && lazy) {
+			lazy_table = open_lazy_table(table);
+		} else if (table != NULL) {
+			build_table(table);
+		}
 
-		printf("Enter postfix expressions (CTRL-D to exit):\n");
-		// Read-eval-print loop
-		char buffer[BUFLEN];
-		printf("> ");
-		while (fgets(buffer, sizeof(buffer), stdin)) { // Stdin takes any input from user
-			// Ignore lines starting with '#'
-			if (buffer[0] == '#') {
-				printf("> ");
-				continue;
+		size_t num_tokens;
+		tree_node_t *root = parse_line(sweep_expr, &num_tokens);
+		if (root == NULL) {
+			if (num_tokens == 0) {
+				fprintf(stderr, "Error: Sweep expression is empty.\n");
 			}
+			return EXIT_FAILURE; // parse already said what was wrong
+		}
+		run_sweep(sweep_spec, root, threads);
+		cleanup_tree(root);
+		lazytab_finish(lazy_table);
+		return EXIT_SUCCESS;
+	}
 
-			// If line has a '#', but not at beginning, ignore everything after it
-			// Assignment receommends usage of "strchr" and replacing '#' with a null byte... clever
-			char * ignore = strchr(buffer, '#'); // Search the buffer for the first #
-			if (ignore) { // If there is a # and ignore is initialized
-				*ignore = '\0';
-			}
+	if (perf_counters) {
+		perf_start(); // Says so if there are none, and then counts nothing
+	}
 
-			// Perform similar action as above to trim off newlines
-			char * newline = strchr(buffer, '\n');
-			if (newline) {
-				*newline = '\0';
-			}
+	// Check the image before anything is printed
+	perf_enter(PERF_LOAD);
+	pfc_image_t *image = run != NULL ? pfc_open(run) : NULL;
+
+	int loaded = table != NULL; // Whether there is a table to dump
+	if (shm_name != NULL) {
+		// Either the table file or whatever is already shared
+		loaded = attach_shared_table(shm_name, table) || loaded;
+	} else if (wal_dir != NULL) {
+		// Either the table file or whatever the log recovers
+		loaded = wal_open(wal_dir, table, checkpoint_every) || loaded;
+	} else if (table != NULL && lazy) {
+		// Only the lines that are used get read, unless the table is dumped
+		lazy_table = open_lazy_table(table);
+	} else if (table != NULL) {
+		//printf("Building table.\n");
+		build_table(table);
+	}
+	perf_leave();
+	if (loaded && !no_dump) {
+		//printf("Dumping table.\n");
+		perf_enter(PERF_PRINT);
+		dump_table();
+		perf_leave();
+	}
 
-			// Read of line complete, send it over to the eval
-			//printf("\"%s\"\n", buffer);
-			eval_and_print(buffer);
-			}
-		} else if (argc == 1) {
-			printf("Enter postfix expressions (CTRL-D to exit):\n");
-
-                	char buffer[BUFLEN];
-                	printf("> ");
-                	while (fgets(buffer, sizeof(buffer), stdin)) { // Stdin takes any input from user
-                        	// Ignore lines starting with '#'
-                        	if (buffer[0] == '#') {
-                                	printf("> ");
-                                	continue;
-                        	}
-
-                        	// If line has a '#', but not at beginning, ignore everything after it
-                        	// Assignment receommends usage of "strchr" and replacing '#' with a null byte... clever
-                        	char * ignore = strchr(buffer, '#'); // Search the buffer for the first #
-                        	if (ignore) { // If there is a # and ignore is initialized
-                                	*ignore = '\0';
-                        	}
-
-                        	// Perform similar action as above to trim off newlines
-                        	char * newline = strchr(buffer, '\n');
-                        	if (newline) {
-                                	*newline = '\0';
-                        	}
-
-                        	// Read of line complete, send it over to the eval
-                        	//printf("\"%s\"\n", buffer);
-                        	eval_and_print(buffer);
-			}
+	printf("Enter postfix expressions (CTRL-D to exit):\n");
+	// Read-eval-print loop
+	if (image != NULL) {
+		run_script(image);
+		pfc_unmap(image);
+	} else {
+		repl(stdin);
+	}
+	while (pop_scope()) {
+		// Scopes still open at the end are thrown away
+	}
+	lazytab_finish(lazy_table); // Before the dump, so a bad table still fails the run
+	if (!no_dump) {
+		perf_enter(PERF_PRINT);
+		dump_table();
+		perf_leave();
 	}
-	dump_table();
+	wal_close();
+	perf_stop();
 	return EXIT_SUCCESS;
 }
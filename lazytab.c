@@ -0,0 +1,644 @@
+/*
+ * lazytab.c
+ *
+ * Lazily loaded symbol tables. The file is mapped read only and a line
+ * is found by its name, through the index the index thread builds or,
+ * until that is published, by scanning the file. Symbols made from the
+ * file and symbols added later are both proxies, kept in chains hashed
+ * by name that are added to with a CAS the way the symbol list is.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "lazytab.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TAG_BITS 20             // bits of the hash kept in each index slot
+#define TAG_MASK ((1u << TAG_BITS) - 1)
+#define NO_LINE ((size_t) -1)   // a name that is not in the file
+
+// What is wrong with a line (the checks build_table makes, in its order)
+typedef enum line_error_e {
+	LINE_OK,
+	LINE_BAD_FORMAT,        // not a name followed by a number
+	LINE_BAD_NAME           // the name does not start with a letter
+} line_error_t;
+
+// One line of the file, parsed
+typedef struct line_s {
+	const char *name;       // the name, in the mapping (not terminated)
+	size_t name_len;        // its length
+	int val;                // the value
+} line_t;
+
+// A symbol; symbol comes first so a symbol_t * can be turned back into one
+typedef struct lazy_proxy_s {
+	symbol_t symbol;        // what lookups return
+	struct lazy_proxy_s *chain; // the next proxy in the same bucket
+	struct lazy_proxy_s *older; // the next older proxy that is not in the file
+} lazy_proxy_t;
+
+// A lazily loaded table
+struct lazytab_s {
+	const char *map;        // the file, or NULL if it is empty
+	size_t size;            // its size
+	lazy_proxy_t **buckets; // heads of the proxy chains
+	size_t bucket_mask;     // the number of buckets - 1
+	lazy_proxy_t *added;    // proxies that are not in the file, newest first
+	uint64_t *slots;        // the index once it is published, each (line + 1) << TAG_BITS | tag or 0
+	size_t slot_mask;       // the number of slots - 1
+	int error;              // the first bad line the index thread found (a line_error_t)
+	int stop;               // tells the index thread to give up
+	int joined;             // whether the index thread has been waited for
+	int listed_file;        // whether lazytab_new_symbols has listed the file's symbols
+	lazy_proxy_t *listed_added; // the newest added proxy it has listed
+	pthread_t indexer;      // the index thread
+};
+
+/// Hashes a name (64 bit FNV-1a)
+///
+/// @param name The name
+/// @param len Its length
+/// @return The hash
+static uint64_t hash_name(const char *name, size_t len) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char) name[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/// Finds the end of a line
+///
+/// @param lazy The table
+/// @param start Where the line starts
+/// @param len Set to its length, without the newline
+/// @return Where the next line starts
+static size_t line_at(lazytab_t *lazy, size_t start, size_t *len) {
+	const char *newline = (const char *) memchr(lazy->map + start, '\n', lazy->size - start);
+	size_t end = newline != NULL ? (size_t) (newline - lazy->map) : lazy->size;
+	*len = end - start;
+	return newline != NULL ? end + 1 : end;
+}
+
+/// Finds the start of the line before another, reading the file backward
+///
+/// @param lazy The table
+/// @param end Where the line ends (its newline, or the end of the file)
+/// @return Where it starts
+static size_t line_before(lazytab_t *lazy, size_t end) {
+	while (end > 0 && lazy->map[end - 1] != '\n') {
+		end--;
+	}
+	return end;
+}
+
+/// Where the last line of the file ends
+///
+/// @param lazy The table
+/// @return Its end, not counting its newline
+static size_t last_line_end(lazytab_t *lazy) {
+	size_t end = lazy->size;
+	if (end > 0 && lazy->map[end - 1] == '\n') {
+		end--; // The last line's newline, not an empty line after it
+	}
+	return end;
+}
+
+/// Finds the name at the start of a line
+///
+/// @param text The line
+/// @param len Its length
+/// @param line Set to the name
+/// @return The offset just past the name, or 0 if there is none
+static size_t parse_name(const char *text, size_t len, line_t *line) {
+	size_t i = 0;
+	while (i < len && isspace((unsigned char) text[i])) {
+		i++;
+	}
+	size_t start = i;
+	while (i < len && !isspace((unsigned char) text[i])) {
+		i++;
+	}
+	line->name = text + start;
+	line->name_len = i - start;
+	return line->name_len > 0 ? i : 0;
+}
+
+/// Parses a line the way build_table does with sscanf "%s %d"
+///
+/// @param text The line
+/// @param len Its length
+/// @param line Set to the name and value
+/// @return LINE_OK, or what is wrong with it
+static line_error_t parse_line(const char *text, size_t len, line_t *line) {
+	size_t i = parse_name(text, len, line);
+	if (i == 0) {
+		return LINE_BAD_FORMAT;
+	}
+	while (i < len && isspace((unsigned char) text[i])) {
+		i++;
+	}
+
+	int negative = i < len && text[i] == '-';
+	if (i < len && (text[i] == '-' || text[i] == '+')) {
+		i++;
+	}
+	if (i == len || !isdigit((unsigned char) text[i])) {
+		return LINE_BAD_FORMAT;
+	}
+
+	// Saturates like strtol, so huge values come out as sscanf makes them
+	unsigned long long magnitude = 0;
+	for (; i < len && isdigit((unsigned char) text[i]); i++) {
+		if (magnitude <= (unsigned long long) LONG_MAX + 1) {
+			magnitude = magnitude * 10 + (text[i] - '0');
+		}
+	}
+	long val;
+	if (negative) {
+		val = magnitude > (unsigned long long) LONG_MAX ? LONG_MIN : -(long) magnitude;
+	} else {
+		val = magnitude > (unsigned long long) LONG_MAX ? LONG_MAX : (long) magnitude;
+	}
+	line->val = (int) val;
+
+	// A symbol is an alphanumeric string starting with an alphabetic character
+	return isalpha((unsigned char) line->name[0]) ? LINE_OK : LINE_BAD_NAME;
+}
+
+/// Exits with the message build_table gives for a bad line
+///
+/// @param error What is wrong with the line
+static void report(line_error_t error) {
+	if (error == LINE_BAD_NAME) {
+		fprintf(stderr, "Error: Invalid symbol name.\n");
+	} else {
+		fprintf(stderr, "Error: Symbol table line contains incorrect format.\n");
+	}
+	exit(EXIT_FAILURE);
+}
+
+/// Checks whether a line is for a name
+///
+/// @param lazy The table
+/// @param pos Where the line starts
+/// @param name The name
+/// @param len Its length
+/// @return 1 if it is, 0 otherwise
+static int line_is(lazytab_t *lazy, size_t pos, const char *name, size_t len) {
+	size_t line_len;
+	line_t line;
+	line_at(lazy, pos, &line_len);
+	return parse_name(lazy->map + pos, line_len, &line) != 0 && line.name_len == len &&
+		memcmp(line.name, name, len) == 0;
+}
+
+/// Builds the index of where each name's line starts, then publishes it
+///
+/// @param arg The table
+/// @return NULL
+static void *index_lines(void *arg) {
+	lazytab_t *lazy = (lazytab_t *) arg;
+	size_t lines = 1;
+	for (const char *at = lazy->map; at != NULL && at < lazy->map + lazy->size; lines++) {
+		at = (const char *) memchr(at, '\n', lazy->map + lazy->size - at);
+		at = at != NULL ? at + 1 : NULL;
+	}
+	size_t cap = 16;
+	while (cap < lines * 2) { // At most half full
+		cap *= 2;
+	}
+	uint64_t *slots = (uint64_t *) calloc(cap, sizeof(uint64_t));
+	if (slots == NULL) { // Check if calloc failed
+		fprintf(stderr, "Error: symbol index memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t next = 0;
+	for (size_t pos = 0, n = 0; pos < lazy->size; pos = next, n++) {
+		if (n % 4096 == 0 && __atomic_load_n(&lazy->stop, __ATOMIC_ACQUIRE)) {
+			free(slots);
+			return NULL;
+		}
+		size_t len;
+		next = line_at(lazy, pos, &len);
+		if (lazy->map[pos] == '#') {
+			continue; // Skip the lines starting with '#'
+		}
+
+		line_t line;
+		line_error_t error = parse_line(lazy->map + pos, len, &line);
+		if (error != LINE_OK) {
+			int none = LINE_OK; // Only the first, which is the one build_table would stop at
+			__atomic_compare_exchange_n(&lazy->error, &none, (int) error, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+			if (line.name_len == 0) {
+				continue; // Nothing to find it by
+			}
+		}
+
+		// Open addressing; the last line for a name wins, as the newest node of a loaded list does
+		uint64_t hash = hash_name(line.name, line.name_len);
+		size_t i = (hash >> TAG_BITS) & (cap - 1);
+		for (; slots[i] != 0; i = (i + 1) & (cap - 1)) {
+			if ((slots[i] & TAG_MASK) == (hash & TAG_MASK) &&
+				line_is(lazy, (slots[i] >> TAG_BITS) - 1, line.name, line.name_len)) {
+				break;
+			}
+		}
+		slots[i] = (uint64_t) (pos + 1) << TAG_BITS | (hash & TAG_MASK);
+	}
+
+	lazy->slot_mask = cap - 1;
+	__atomic_store_n(&lazy->slots, slots, __ATOMIC_RELEASE); // Lookups stop scanning
+	return NULL;
+}
+
+/// Finds the line for a name, the last one if there are several
+///
+/// @param lazy The table
+/// @param name The name
+/// @param len Its length
+/// @param hash Its hash
+/// @return Where its line starts, or NO_LINE
+static size_t find_line(lazytab_t *lazy, const char *name, size_t len, uint64_t hash) {
+	uint64_t *slots = __atomic_load_n(&lazy->slots, __ATOMIC_ACQUIRE);
+	if (slots != NULL) {
+		for (size_t i = (hash >> TAG_BITS) & lazy->slot_mask; slots[i] != 0; i = (i + 1) & lazy->slot_mask) {
+			size_t pos = (slots[i] >> TAG_BITS) - 1;
+			if ((slots[i] & TAG_MASK) == (hash & TAG_MASK) && line_is(lazy, pos, name, len)) {
+				return pos;
+			}
+		}
+		return NO_LINE;
+	}
+
+	// The index is not ready yet, so look at every line, last first
+	size_t end = last_line_end(lazy);
+	while (lazy->map != NULL) {
+		size_t pos = line_before(lazy, end);
+		line_t line;
+		if (lazy->map[pos] != '#' && parse_name(lazy->map + pos, end - pos, &line) != 0 &&
+			line.name_len == len && memcmp(line.name, name, len) == 0) {
+			return pos;
+		}
+		if (pos == 0) {
+			break;
+		}
+		end = pos - 1;
+	}
+	return NO_LINE;
+}
+
+/// Parses the line for a name, which must be good
+///
+/// @param lazy The table
+/// @param pos Where the line starts
+/// @param line Set to the name and value
+static void read_line_at(lazytab_t *lazy, size_t pos, line_t *line) {
+	size_t len;
+	line_at(lazy, pos, &len);
+	line_error_t error = parse_line(lazy->map + pos, len, line);
+	if (error != LINE_OK) {
+		report(error);
+	}
+}
+
+/// Searches a chain from first up to (not including) last
+///
+/// @param first The proxy to start at
+/// @param last The proxy to stop at, or NULL for the end of the chain
+/// @param name The name
+/// @param len Its length
+/// @return The proxy, or NULL if not found
+static lazy_proxy_t *search_chain(lazy_proxy_t *first, lazy_proxy_t *last, const char *name, size_t len) {
+	for (lazy_proxy_t *proxy = first; proxy != last; proxy = proxy->chain) {
+		if (strncmp(proxy->symbol.var_name, name, len) == 0 && proxy->symbol.var_name[len] == '\0') {
+			return proxy;
+		}
+	}
+	return NULL;
+}
+
+/// Returns the bucket for a name
+///
+/// @param lazy The table
+/// @param hash The hash of the name
+/// @return The head of its chain
+static lazy_proxy_t **bucket_of(lazytab_t *lazy, uint64_t hash) {
+	return &lazy->buckets[hash & lazy->bucket_mask];
+}
+
+/// Returns the proxy for a name, adding it if there is none
+///
+/// @param lazy The table
+/// @param name The name
+/// @param len Its length
+/// @param hash Its hash
+/// @param val The value for a new proxy
+/// @param in_file Whether the name is in the file
+/// @return The proxy
+static lazy_proxy_t *get_proxy(lazytab_t *lazy, const char *name, size_t len, uint64_t hash, int val, int in_file) {
+	lazy_proxy_t **bucket = bucket_of(lazy, hash);
+	lazy_proxy_t *seen = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+	lazy_proxy_t *proxy = search_chain(seen, NULL, name, len);
+	if (proxy != NULL) {
+		return proxy;
+	}
+
+	proxy = (lazy_proxy_t *) malloc(sizeof(lazy_proxy_t));
+	char *copy = strndup(name, len);
+	if (proxy == NULL || copy == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: symbol memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	proxy->symbol.var_name = copy;
+	proxy->symbol.val = val;
+	proxy->symbol.depth = 0;
+	proxy->symbol.shared = NULL;
+	proxy->symbol.outer = NULL;
+	proxy->symbol.next = NULL;
+	proxy->older = NULL;
+
+	lazy_proxy_t *old_head = seen;
+	for (;;) {
+		proxy->chain = old_head;
+		if (__atomic_compare_exchange_n(bucket, &old_head, proxy, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+
+		// Someone else added to the chain first, only what they added can be our name
+		lazy_proxy_t *found = search_chain(old_head, seen, name, len);
+		if (found != NULL) {
+			free(proxy->symbol.var_name);
+			free(proxy);
+			return found;
+		}
+		seen = old_head;
+	}
+
+	if (!in_file) {
+		lazy_proxy_t *older = __atomic_load_n(&lazy->added, __ATOMIC_RELAXED);
+		do {
+			proxy->older = older;
+		} while (!__atomic_compare_exchange_n(&lazy->added, &older, proxy, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	return proxy;
+}
+
+/// Looks a symbol up, making it from the file if needed
+///
+/// @param lazy The table
+/// @param name The name of the variable
+/// @return The symbol, or NULL if not found
+symbol_t *lazytab_lookup(lazytab_t *lazy, char *name) {
+	size_t len = strlen(name);
+	uint64_t hash = hash_name(name, len);
+	lazy_proxy_t *proxy = search_chain(__atomic_load_n(bucket_of(lazy, hash), __ATOMIC_ACQUIRE), NULL, name, len);
+	if (proxy != NULL) {
+		return &proxy->symbol;
+	}
+
+	size_t pos = find_line(lazy, name, len, hash);
+	if (pos == NO_LINE) {
+		return NULL;
+	}
+	line_t line;
+	read_line_at(lazy, pos, &line); // The value is only parsed now
+	return &get_proxy(lazy, name, len, hash, line.val, 1)->symbol;
+}
+
+/// Binds a value to a variable, adding it if needed
+///
+/// @param lazy The table
+/// @param name The name of the variable
+/// @param val The value to bind
+/// @return The symbol holding the binding
+symbol_t *lazytab_bind(lazytab_t *lazy, char *name, int val) {
+	size_t len = strlen(name);
+	uint64_t hash = hash_name(name, len);
+	lazy_proxy_t *proxy = search_chain(__atomic_load_n(bucket_of(lazy, hash), __ATOMIC_ACQUIRE), NULL, name, len);
+	if (proxy == NULL) {
+		size_t pos = find_line(lazy, name, len, hash);
+		if (pos != NO_LINE) {
+			line_t line;
+			read_line_at(lazy, pos, &line); // Still has to be a good line
+		}
+		proxy = get_proxy(lazy, name, len, hash, val, pos != NO_LINE);
+	}
+	set_symbol_val(&proxy->symbol, val); // It may have been made by someone else
+	return &proxy->symbol;
+}
+
+/// Prints every symbol the way dump_table prints them
+///
+/// @param lazy The table
+void lazytab_dump(lazytab_t *lazy) {
+	for (lazy_proxy_t *proxy = __atomic_load_n(&lazy->added, __ATOMIC_ACQUIRE); proxy != NULL; proxy = proxy->older) {
+		printf("\tName: %s, Value: %d\n", proxy->symbol.var_name, get_symbol_val(&proxy->symbol));
+	}
+
+	// Last line first, like a list the file was loaded into
+	size_t end = last_line_end(lazy);
+	while (lazy->map != NULL) {
+		size_t start = line_before(lazy, end);
+		if (lazy->map[start] != '#') {
+			line_t line;
+			line_error_t error = parse_line(lazy->map + start, end - start, &line);
+			if (error != LINE_OK) {
+				report(error);
+			}
+
+			// A proxy only stands for the last line with its name; earlier ones are shadowed
+			uint64_t hash = hash_name(line.name, line.name_len);
+			lazy_proxy_t *proxy = search_chain(__atomic_load_n(bucket_of(lazy, hash), __ATOMIC_ACQUIRE), NULL,
+				line.name, line.name_len);
+			if (proxy != NULL && find_line(lazy, line.name, line.name_len, hash) != start) {
+				proxy = NULL;
+			}
+			printf("\tName: %.*s, Value: %d\n", (int) line.name_len, line.name,
+				proxy != NULL ? get_symbol_val(&proxy->symbol) : line.val);
+		}
+		if (start == 0) {
+			break;
+		}
+		end = start - 1;
+	}
+}
+
+/// Adds a symbol to a growing array
+///
+/// @param symbols The array
+/// @param count The number of symbols in it
+/// @param cap Its size
+/// @param symbol The symbol
+static void append_symbol(symbol_t ***symbols, size_t *count, size_t *cap, symbol_t *symbol) {
+	if (*count == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		symbol_t **bigger = (symbol_t **) realloc(*symbols, *cap * sizeof(symbol_t *));
+		if (bigger == NULL) { // Check if realloc failed
+			fprintf(stderr, "Error: symbol memory allocation failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		*symbols = bigger;
+	}
+	(*symbols)[(*count)++] = symbol;
+}
+
+/// Lists the symbols added since the last call, and on the first call
+/// every symbol of the file as well
+///
+/// @param lazy The table
+/// @param count Set to the number of symbols
+/// @return The symbols (the array must be freed)
+symbol_t **lazytab_new_symbols(lazytab_t *lazy, size_t *count) {
+	symbol_t **symbols = NULL;
+	size_t cap = 0;
+	*count = 0;
+	lazy_proxy_t *newest = __atomic_load_n(&lazy->added, __ATOMIC_ACQUIRE);
+	for (lazy_proxy_t *proxy = newest; proxy != lazy->listed_added; proxy = proxy->older) {
+		append_symbol(&symbols, count, &cap, &proxy->symbol);
+	}
+	lazy->listed_added = newest;
+	if (lazy->listed_file) {
+		return symbols;
+	}
+
+	// Last line first, so a name in the file twice gets the value of its last line
+	size_t end = last_line_end(lazy);
+	while (lazy->map != NULL) {
+		size_t pos = line_before(lazy, end);
+		line_t line;
+		if (lazy->map[pos] != '#') {
+			line_error_t error = parse_line(lazy->map + pos, end - pos, &line);
+			if (error != LINE_OK) {
+				report(error);
+			}
+			lazy_proxy_t *proxy = get_proxy(lazy, line.name, line.name_len,
+				hash_name(line.name, line.name_len), line.val, 1);
+			append_symbol(&symbols, count, &cap, &proxy->symbol); // Once for each of its lines
+		}
+		if (pos == 0) {
+			break;
+		}
+		end = pos - 1;
+	}
+	lazy->listed_file = 1;
+	return symbols;
+}
+
+/// Reports a bad line found by the index thread
+///
+/// @param lazy The table, or NULL for none
+void lazytab_check(lazytab_t *lazy) {
+	if (lazy == NULL) {
+		return;
+	}
+	int error = __atomic_load_n(&lazy->error, __ATOMIC_ACQUIRE);
+	if (error != LINE_OK) {
+		report((line_error_t) error);
+	}
+}
+
+/// Waits for the index thread, then reports a bad line if it found one
+///
+/// @param lazy The table, or NULL
+void lazytab_finish(lazytab_t *lazy) {
+	if (lazy == NULL) {
+		return;
+	}
+	if (!lazy->joined) {
+		pthread_join(lazy->indexer, NULL);
+		lazy->joined = 1;
+	}
+	lazytab_check(lazy);
+}
+
+/// Makes the symbol table a lazily loaded table
+///
+/// @param filename The symbol table file
+/// @return The table
+lazytab_t *open_lazy_table(char *filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) { // Check if file open failed
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+
+	lazytab_t *lazy = (lazytab_t *) calloc(1, sizeof(lazytab_t));
+	if (lazy == NULL) { // Check if calloc failed
+		fprintf(stderr, "Error: symbol memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	lazy->size = st.st_size;
+	if (lazy->size > 0) { // mmap refuses empty files
+		void *map = mmap(NULL, lazy->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			perror(filename);
+			exit(EXIT_FAILURE);
+		}
+		lazy->map = (const char *) map;
+	}
+	close(fd);
+
+	// Roughly one bucket per few lines, but untouched pages of it cost nothing
+	size_t buckets = LAZY_MIN_BUCKETS;
+	while (buckets < lazy->size / 16 && buckets < (size_t) 1 << 24) {
+		buckets *= 2;
+	}
+	lazy->buckets = (lazy_proxy_t **) calloc(buckets, sizeof(lazy_proxy_t *));
+	if (lazy->buckets == NULL) { // Check if calloc failed
+		fprintf(stderr, "Error: symbol memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	lazy->bucket_mask = buckets - 1;
+
+	if (pthread_create(&lazy->indexer, NULL, index_lines, lazy) != 0) {
+		fprintf(stderr, "Error: Could not start the symbol table index thread.\n");
+		exit(EXIT_FAILURE);
+	}
+	use_lazy_table(lazy);
+	return lazy;
+}
+
+/// Stops the index thread and frees the table
+///
+/// @param lazy The table
+void lazytab_close(lazytab_t *lazy) {
+	__atomic_store_n(&lazy->stop, 1, __ATOMIC_RELEASE);
+	if (!lazy->joined) {
+		pthread_join(lazy->indexer, NULL);
+	}
+	free(lazy->slots);
+
+	for (size_t i = 0; i <= lazy->bucket_mask; i++) {
+		lazy_proxy_t *proxy = lazy->buckets[i];
+		while (proxy != NULL) {
+			lazy_proxy_t *next = proxy->chain;
+			free(proxy->symbol.var_name);
+			free(proxy);
+			proxy = next;
+		}
+	}
+	free(lazy->buckets);
+	if (lazy->map != NULL) {
+		munmap((void *) lazy->map, lazy->size);
+	}
+	free(lazy);
+}
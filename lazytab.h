@@ -0,0 +1,83 @@
+/// Symbol tables loaded on demand from the table file (--lazy)
+///
+/// Instead of reading every line of the table file before the first
+/// prompt, the file is mapped and a symbol is only made the first time
+/// it is looked up, by finding its line and parsing its value then.  A
+/// background thread builds an index of where each name's line starts;
+/// until it is done, lookups scan the file for the line themselves.
+///
+/// The index thread also checks every line, so a bad table file is
+/// still found out even if its bad line is never looked up: the error
+/// is reported by the next lazytab_check, with the same message
+/// build_table would have given.  A bad line that is looked up is
+/// reported right away.
+///
+/// Symbols that are not in the file are kept with the rest, so the
+/// file itself is never written.  It must not change while it is mapped.
+
+#ifndef LAZYTAB_H
+#define LAZYTAB_H
+
+#include <stddef.h>
+#include "symtab.h"
+
+#define LAZY_MIN_BUCKETS 1024   // symbols made before chains start to grow
+
+typedef struct lazytab_s lazytab_t;
+
+/// Makes the symbol table a lazily loaded table
+/// @param filename  the symbol table file
+/// @return the table
+/// @exception If the file can't be opened or mapped, an error message
+///     is displayed and the program exits with EXIT_FAILURE.
+lazytab_t *open_lazy_table(char *filename);
+
+/// Reports a bad line found by the index thread, if it has found one
+/// @param lazy  the table, or NULL
+/// @exception If a line of the file is bad, the error message
+///     build_table gives for it is displayed and the program exits
+///     with EXIT_FAILURE.
+void lazytab_check(lazytab_t *lazy);
+
+/// Waits for the index thread to check every line, then does what
+/// lazytab_check does.  Called before exiting, so a bad table file
+/// fails the run however early it ends.
+/// @param lazy  the table, or NULL
+/// @exception As lazytab_check.
+void lazytab_finish(lazytab_t *lazy);
+
+/// Looks a symbol up, making it from its line of the file if needed
+/// @param lazy  the table
+/// @param name  the name of the variable
+/// @return the symbol (owned by the table), or NULL if not found
+/// @exception If the line is bad, the program exits as in lazytab_check.
+symbol_t *lazytab_lookup(lazytab_t *lazy, char *name);
+
+/// Binds a value to a variable, adding it if needed
+/// @param lazy  the table
+/// @param name  the name of the variable
+/// @param val  the value to bind
+/// @return the symbol holding the binding
+symbol_t *lazytab_bind(lazytab_t *lazy, char *name, int val);
+
+/// Prints every symbol the way dump_table prints an eagerly loaded
+/// table: symbols added since, newest first, then the file's symbols
+/// from its last line to its first.  Reads the whole file.
+/// @param lazy  the table
+void lazytab_dump(lazytab_t *lazy);
+
+/// Lists the symbols added since the last call, in no particular
+/// order.  The first call also makes every symbol of the file and lists
+/// it, reading the whole file; a name on several lines is listed once
+/// for each.  Only one thread may call it.
+/// @param lazy  the table
+/// @param count  set to the number of symbols
+/// @return the symbols, owned by the table (the array must be freed,
+///     and may be NULL if there are none)
+symbol_t **lazytab_new_symbols(lazytab_t *lazy, size_t *count);
+
+/// Stops the index thread, unmaps the file and frees the symbols
+/// @param lazy  the table (freed)
+void lazytab_close(lazytab_t *lazy);
+
+#endif
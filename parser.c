@@ -0,0 +1,270 @@
+/*
+ * parser.c
+ *
+ * Parsing, evaluation and printing of postfix expression trees
+ * (split out of interp.c so other front ends can share them)
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "parser.h"
+#include "symtab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int error_flag = 0; // Global error flag
+parse_error_t parse_error = PARSE_NONE; // Why the last parse failed
+
+/// Reports an evaluation error and sets the error flag
+///
+/// @param error The error that occurred
+void eval_fail(eval_error_t error) {
+	switch (error) {
+		case DIVISION_BY_ZERO: fprintf(stderr, "Error: Division by zero.\n"); break;
+		case UNDEFINED_SYMBOL: fprintf(stderr, "Error: Undefined symbol.\n"); break;
+		case UNKNOWN_OPERATION: fprintf(stderr, "Error: Unknown operation.\n"); break;
+		case INVALID_LVALUE: fprintf(stderr, "Error: Invalid l-value.\n"); break;
+		case SYMTAB_FULL: fprintf(stderr, "Error: Symbol table full.\n"); break;
+		default: fprintf(stderr, "Error: Unkonwn node type.\n"); break;
+	}
+	error_flag = 1; // Set error flag
+}
+
+/// Reports a parse error and sets the error flag
+///
+/// @param error The error that occurred
+void parse_fail(parse_error_t error) {
+	switch (error) {
+		case TOO_FEW_TOKENS: fprintf(stderr, "Error: Stack is empty.\n"); break;
+		case ILLEGAL_TOKEN: fprintf(stderr, "Error: Illegal token.\n"); break;
+		default: fprintf(stderr, "Error: Unknown operation.\n"); break;
+	}
+	parse_error = error;
+	error_flag = 1; // Set error flag
+}
+
+/// Evaluates the given parse tree node
+///
+/// @param node The parse tree node to evaluate
+/// @return The evaluated integer value, or -1 if an error occurs
+int eval_tree(tree_node_t *node) {
+	if (error_flag) {
+        	return -1; // Terminate if an error has occurred
+    	}
+
+    	if (node->type == LEAF) {
+        	leaf_node_t *leaf = (leaf_node_t *) node->node;
+        	if (leaf->exp_type == INTEGER) {
+            		return strtol(node->token, NULL, 10);
+
+        	} else if (leaf->exp_type == SYMBOL) {
+            		symbol_t *symbol = lookup_table(node->token);
+
+            		if (symbol == NULL) {
+                		eval_fail(UNDEFINED_SYMBOL);
+                		return -1;
+            		}
+			return get_symbol_val(symbol);
+        	}
+
+    	} else if (node->type == INTERIOR) {
+        	interior_node_t *interior = (interior_node_t *) node->node;
+
+        	if (interior->op == ASSIGN_OP) {
+            		if (interior->left->type != LEAF || ((leaf_node_t *) interior->left->node)->exp_type != SYMBOL) {
+                		eval_fail(INVALID_LVALUE);
+                		return -1;
+            		}
+            		int val = eval_tree(interior->right);
+
+			if (error_flag) {
+                		return -1; // Propagate error
+            		}
+
+            		if (bind_symbol(interior->left->token, val) == NULL) {
+				eval_fail(SYMTAB_FULL); // Only shared tables fill up
+				return -1;
+			}
+
+            		return val;
+
+        } else if (interior->op == Q_OP) {
+            	int test_val = eval_tree(interior->left);
+		if (error_flag) {
+                	return -1; // Propagate error
+            	}
+            	interior_node_t *alt_node = (interior_node_t *) interior->right->node;
+
+		if (test_val) {
+                	return eval_tree(alt_node->left);
+
+            	} else {
+                	return eval_tree(alt_node->right);
+            	}
+        } else {
+            	int left_val = eval_tree(interior->left);
+
+		if (error_flag) {
+                	return -1; // Propagate error
+            	}
+
+            	int right_val = eval_tree(interior->right);
+
+		if (error_flag) {
+                	return -1; // Propagate error
+            	}
+
+            		switch (interior->op) { // Shoutout SI session for going over these
+                		case ADD_OP: return left_val + right_val;
+                		case SUB_OP: return left_val - right_val;
+                		case MUL_OP: return left_val * right_val;
+                		case DIV_OP:
+					if (right_val == 0) {
+                        			eval_fail(DIVISION_BY_ZERO);
+                        			return -1;
+                    			}
+                    			return left_val / right_val;
+                		case MOD_OP:
+					if (right_val == 0) {
+                        			eval_fail(DIVISION_BY_ZERO);
+                        			return -1;
+                    			}
+                    			return left_val % right_val;
+                		default: eval_fail(UNKNOWN_OPERATION);
+				return -1;
+            		}
+        	}
+    	}
+    	eval_fail(UNKNOWN_EXP_TYPE);
+    	return -1;
+}
+
+/// Prints the parse tree with the infix notation - "Easiest part of the assignment"
+///
+/// @param out The stream to print to
+/// @param node The parse tree node to print
+void fprint_infix(FILE *out, tree_node_t *node) {
+    	if (node->type == LEAF) {
+        	fprintf(out, "%s", node->token);
+
+    	} else if (node->type == INTERIOR) {
+        	interior_node_t *interior = (interior_node_t *)node->node;
+
+        	fprintf(out, "(");
+
+        	fprint_infix(out, interior->left);
+        	fprintf(out, "%s", node->token);
+        	fprint_infix(out, interior->right);
+
+        	fprintf(out, ")");
+    	}
+}
+
+/// Prints the parse tree with the infix notation to standard output
+///
+/// @param node The parse tree node to print
+void print_infix(tree_node_t *node) {
+	fprint_infix(stdout, node);
+}
+
+/// Frees a parse tree and everything hanging off of it
+///
+/// @param node The root of the tree to free (may be NULL)
+void cleanup_tree(tree_node_t *node) {
+	if (node == NULL) {
+		return;
+	}
+
+	if (node->type == INTERIOR) {
+		interior_node_t *interior = (interior_node_t *) node->node;
+		cleanup_tree(interior->left);
+		cleanup_tree(interior->right);
+	}
+	free(node->node);
+	free(node->token);
+	free(node);
+}
+
+/// Gets the operator type for the given token
+///
+/// @param token The token to get the operator type for
+/// @return The operator type, or NO_OP if the token is not a valid operator
+op_type_t get_op_type(char *token) {
+	if (strcmp(token, ADD_OP_STR) == 0) {
+		return ADD_OP;
+	} else if (strcmp(token, SUB_OP_STR) == 0) {
+		return SUB_OP;
+	} else if (strcmp(token, MUL_OP_STR) == 0) {
+		return MUL_OP;
+	} else if (strcmp(token, DIV_OP_STR) == 0) {
+		return DIV_OP;
+	} else if (strcmp(token, MOD_OP_STR) == 0) {
+		return MOD_OP;
+    	} else if (strcmp(token, ASSIGN_OP_STR) == 0) {
+		return ASSIGN_OP;
+    	} else if (strcmp(token, Q_OP_STR) == 0) {
+		return Q_OP;
+    	} else {
+		fprintf(stderr, "Error: Unknown operation.\n");
+		error_flag = 1; // Set error flag
+    		return NO_OP;
+	} // In retrospect I think I could've used a switch case and done it better :(
+}
+
+/// Parses the tokens of a line into a parse tree, taking them off the end of the list
+///
+/// @param line The line the tokens came from, with each token null terminated
+/// @param tokens The tokens left to parse
+/// @return The root of the parse tree, or NULL if an error occurs
+tree_node_t *parse(char *line, token_list_t *tokens) { // Build the parse tree from the tokens made in the tokenize function
+    	if (tokens->count == 0) { // Check if we ran out of tokens
+        	parse_fail(TOO_FEW_TOKENS); // This one is a fatal error, the caller has to exit
+        	return NULL;
+    	}
+
+	token_t *next = &tokens->tokens[--tokens->count]; // Postfix, so the last token is the root
+    	char *token = line + next->start;
+
+	// Figure out what kind of token (a+10)>we are dealing with and handle them appropriately
+    	if (next->type == TOKEN_OP) {
+        	op_type_t op = get_op_type(token);
+        	if (op == NO_OP) return NULL; // Non-fatal error
+        	if (op == Q_OP) {
+            		tree_node_t *false_expr = parse(line, tokens);
+            		if (false_expr == NULL) return NULL; // Propagate error
+            		tree_node_t *true_expr = parse(line, tokens);
+            		if (true_expr == NULL) {
+				cleanup_tree(false_expr);
+				return NULL; // Propagate error
+			}
+            		tree_node_t *test_expr = parse(line, tokens);
+            		if (test_expr == NULL) {
+				cleanup_tree(false_expr);
+				cleanup_tree(true_expr);
+				return NULL; // Propagate error
+			}
+            		tree_node_t *alt_node = make_interior(ALT_OP, ":", true_expr, false_expr);
+
+            		return make_interior(Q_OP, token, test_expr, alt_node);
+        	} else {
+            		tree_node_t *right = parse(line, tokens);
+            		if (right == NULL) return NULL; // Propagate error
+            		tree_node_t *left = parse(line, tokens);
+            		if (left == NULL) {
+				cleanup_tree(right);
+				return NULL; // Propagate error
+			}
+
+            		return make_interior(op, token, left, right);
+        	}
+    	} else if (next->type == TOKEN_INT) {
+        	return make_leaf(INTEGER, token);
+    	} else if (next->type == TOKEN_SYMBOL) {
+        	return make_leaf(SYMBOL, token);
+    	} else {
+        	parse_fail(ILLEGAL_TOKEN);
+        	return NULL;
+	// I don't think I like parserland
+    	}
+}
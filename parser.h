@@ -3,8 +3,9 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdio.h>
 #include "tree_node.h"
-#include "stack.h"
+#include "tokenize.h"
 
 // The types of errors that can be run into while parsing
 // or evaluating the tree
@@ -28,6 +29,23 @@ typedef enum eval_error_e {
     SYMTAB_FULL
 } eval_error_t;
 
+/// Set when parsing or evaluating the current expression failed.
+/// It is only cleared by the caller once it has dealt with the error.
+extern int error_flag;
+
+/// The reason the last parse failed (TOO_FEW_TOKENS is fatal)
+extern parse_error_t parse_error;
+
+/// Displays the message for an evaluation error to standard error
+/// and sets error_flag.
+/// @param error  the error that occurred
+void eval_fail(eval_error_t error);
+
+/// Displays the message for a parse error to standard error and
+/// sets error_flag and parse_error.
+/// @param error  the error that occurred
+void parse_fail(parse_error_t error);
+
 /// The main read-eval-print function that reads the expression,
 /// parses it, and evaluates the result, printing the infix expression
 /// and the resulting value to standard output.
@@ -35,11 +53,15 @@ typedef enum eval_error_e {
 /// @param exp The expression as a string
 void rep(char *exp);
 
-/// Recursively build the parse tree from items on the stack
-/// @param stack  the list of tokens to parse
+/// Recursively build the parse tree from the tokens of a line.
+/// Tokens are taken off the end of the list; any left over when the
+/// tree is complete are ignored.
+/// @param line  the line the tokens index into, with every token
+///     null terminated
+/// @param tokens  the list of tokens to parse
 /// @return the root of the parse tree, or NULL on failure
 /// @exception will occur if the parse fails
-tree_node_t *parse(stack_t *stack);
+tree_node_t *parse(char *line, token_list_t *tokens);
 
 /// Constructs the expression tree from the expression.  It
 /// must use the stack to order the tokens.  It must also
@@ -85,6 +107,11 @@ int eval_tree(tree_node_t * node);
 ///     is a parser error.
 void print_infix(tree_node_t * node);
 
+/// Same as print_infix, but writes to the given stream
+/// @param out  the stream to print to
+/// @param node  the tree_node of the tree to print
+void fprint_infix(FILE *out, tree_node_t * node);
+
 /// Cleans up all dynamic memory associated with the expression tree.
 /// @param node The current node in the tree
 void cleanup_tree(tree_node_t * node);
@@ -0,0 +1,212 @@
+/*
+ * perfctr.c
+ *
+ * Phase counts from perf_event_open. The counters form one group led
+ * by the first one that opened, read with PERF_FORMAT_GROUP so a single
+ * read returns all of them at the same moment; a phase's count is the
+ * difference between the reads at its perf_enter and perf_leave. The
+ * reads themselves are counted too, a few hundred instructions each.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "perfctr.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PERF_MAX_COUNTERS 6
+
+// A counter to try to open
+typedef struct perf_event_s {
+	const char *name;       // its column heading
+	uint32_t type;          // PERF_TYPE_*
+	uint64_t config;        // the event
+} perf_event_t;
+
+static const perf_event_t events[PERF_MAX_COUNTERS] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "L1d-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+		PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+	{ "LLC-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK } // Only if none of the rest open
+};
+
+static const char *phase_names[PERF_NUM_PHASES] = { "load", "tokenize", "parse", "eval", "print" };
+
+// What a group read returns (PERF_FORMAT_GROUP with both times)
+typedef struct perf_read_s {
+	uint64_t nr;            // the number of counters
+	uint64_t time_enabled;  // how long the group has been enabled, in ns
+	uint64_t time_running;  // how long it has actually been counting
+	uint64_t values[PERF_MAX_COUNTERS];
+} perf_read_t;
+
+static struct {
+	int leader;             // the group leader's descriptor, -1 if nothing opened
+	int fds[PERF_MAX_COUNTERS]; // each opened counter's descriptor
+	int which[PERF_MAX_COUNTERS]; // which event each opened counter is
+	int count;              // the number opened
+	int phase;              // the phase being counted, -1 if none
+	perf_read_t start;      // the read at its perf_enter
+	uint64_t expr[PERF_NUM_PHASES][PERF_MAX_COUNTERS]; // the current expression's counts
+	uint64_t total[PERF_NUM_PHASES][PERF_MAX_COUNTERS]; // everything's counts
+	unsigned long exprs;    // the number of expressions reported
+} perf = { -1, { 0 }, { 0 }, 0, -1, { 0, 0, 0, { 0 } }, { { 0 } }, { { 0 } }, 0 };
+
+/// Opens one counter
+///
+/// @param event The event to count
+/// @param group The group leader's descriptor, or -1 to lead a new group
+/// @return The descriptor, or -1 with errno set
+static int open_event(const perf_event_t *event, int group) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = event->type;
+	attr.config = event->config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_kernel = 1; // Allowed up to perf_event_paranoid 2, and the reads are in the kernel
+	attr.exclude_hv = 1;
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, 0); // This thread, any CPU
+}
+
+/// Opens the counters
+///
+/// @return The number opened
+int perf_start(void) {
+	char missing[256] = "";
+	int error = 0;
+	for (int i = 0; i < PERF_MAX_COUNTERS; i++) {
+		if (i == PERF_MAX_COUNTERS - 1 && perf.count > 0) {
+			break; // The task clock counts nothing in a group another PMU leads
+		}
+		int fd = open_event(&events[i], perf.leader);
+		if (fd < 0) {
+			error = errno;
+			strncat(missing, " ", sizeof(missing) - strlen(missing) - 1);
+			strncat(missing, events[i].name, sizeof(missing) - strlen(missing) - 1);
+			continue;
+		}
+		if (perf.leader < 0) {
+			perf.leader = fd;
+		}
+		perf.fds[perf.count] = fd;
+		perf.which[perf.count++] = i;
+	}
+
+	if (perf.count > 0) {
+		atexit(perf_stop); // Does nothing if main stopped them already
+	}
+	if (perf.count == 0) {
+		fprintf(stderr, "Warning: performance counters are unavailable (%s), so --perf-counters counts nothing.\n",
+			strerror(error));
+	} else if (perf.which[0] == PERF_MAX_COUNTERS - 1) {
+		fprintf(stderr, "Warning: hardware performance counters are unavailable (%s), so only the task clock is counted.\n",
+			strerror(error));
+	} else if (missing[0] != '\0') {
+		fprintf(stderr, "Warning: some performance counters are unavailable (%s):%s.\n", strerror(error), missing);
+	}
+	return perf.count;
+}
+
+/// Reads every counter at once
+///
+/// @param into Set to the counts
+/// @return 1 if they were read, 0 otherwise
+static int read_group(perf_read_t *into) {
+	ssize_t want = (ssize_t) (3 + perf.count) * (ssize_t) sizeof(uint64_t);
+	return read(perf.leader, into, sizeof(*into)) == want;
+}
+
+/// Starts counting toward a phase
+///
+/// @param phase The phase
+void perf_enter(perf_phase_t phase) {
+	if (perf.leader < 0) {
+		return;
+	}
+	if (read_group(&perf.start)) {
+		perf.phase = phase;
+	}
+}
+
+/// Stops counting toward the current phase
+void perf_leave(void) {
+	perf_read_t now;
+	if (perf.leader < 0 || perf.phase < 0) {
+		return;
+	}
+	if (read_group(&now)) {
+		for (int i = 0; i < perf.count; i++) {
+			uint64_t delta = now.values[i] - perf.start.values[i];
+			perf.expr[perf.phase][i] += delta;
+			perf.total[perf.phase][i] += delta;
+		}
+	}
+	perf.phase = -1;
+}
+
+/// Prints a table of counts, a row per phase
+///
+/// @param title What the counts are of
+/// @param counts The counts
+/// @param first The first phase to print
+static void print_counts(const char *title, uint64_t counts[][PERF_MAX_COUNTERS], int first) {
+	fprintf(stderr, "perf: %s\nperf:   %-10s", title, "phase");
+	for (int i = 0; i < perf.count; i++) {
+		fprintf(stderr, " %14s", events[perf.which[i]].name);
+	}
+	fputc('\n', stderr);
+
+	for (int phase = first; phase < PERF_NUM_PHASES; phase++) {
+		fprintf(stderr, "perf:   %-10s", phase_names[phase]);
+		for (int i = 0; i < perf.count; i++) {
+			fprintf(stderr, " %14llu", (unsigned long long) counts[phase][i]);
+		}
+		fputc('\n', stderr);
+	}
+}
+
+/// Prints the current expression's counts and starts the next one's
+void perf_expr_done(void) {
+	if (perf.leader < 0) {
+		return;
+	}
+	char title[32];
+	snprintf(title, sizeof(title), "expression %lu", ++perf.exprs);
+	fflush(stdout); // So the counts come after what they are counts of, on a terminal
+	print_counts(title, perf.expr, PERF_TOKENIZE); // Loading isn't part of any expression
+	memset(perf.expr, 0, sizeof(perf.expr));
+}
+
+/// Prints the totals and closes the counters
+void perf_stop(void) {
+	if (perf.leader < 0) {
+		return;
+	}
+	perf_read_t now;
+	int multiplexed = read_group(&now) && now.time_running < now.time_enabled;
+
+	fflush(stdout);
+	char title[48];
+	snprintf(title, sizeof(title), "total of %lu expressions", perf.exprs);
+	print_counts(title, perf.total, PERF_LOAD);
+	if (multiplexed) {
+		fprintf(stderr, "perf: the counters were only running %.0f%% of the time, so they are undercounts\n",
+			100.0 * now.time_running / now.time_enabled);
+	}
+
+	for (int i = 0; i < perf.count; i++) {
+		close(perf.fds[i]);
+	}
+	perf.leader = -1;
+	perf.count = 0;
+}
@@ -0,0 +1,53 @@
+/// Hardware performance counters for the phases of the interpreter
+///
+/// With --perf-counters, perf_event_open counts cycles, instructions,
+/// L1 data cache misses, last level cache misses and branch misses in
+/// user space, or if there are no hardware counters, the task clock.
+/// The counters are opened as one group, so one read gives all of them,
+/// and each phase of the interpreter adds what was counted between its
+/// perf_enter and perf_leave.  Each expression's counts go to standard
+/// error once it is printed, and the totals at the end; standard output
+/// is unchanged.
+///
+/// Counters that can't be opened (no PMU in a virtual machine, a
+/// container whose seccomp policy blocks perf_event_open, a high
+/// perf_event_paranoid) are left out with a warning, and if none can
+/// be opened every call here does nothing.
+///
+/// The print phase mostly measures formatting into stdout's buffer:
+/// stdout is flushed before each expression's counts are printed,
+/// outside of any phase.
+
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+// The phases counted separately
+typedef enum perf_phase_e {
+    PERF_LOAD,                  // loading the table or compiled script
+    PERF_TOKENIZE,              // splitting a line into tokens
+    PERF_PARSE,                 // building the parse tree
+    PERF_EVAL,                  // validating and evaluating it
+    PERF_PRINT,                 // printing it, its value and dumps
+    PERF_NUM_PHASES
+} perf_phase_t;
+
+/// Opens the counters and starts counting
+/// @return the number of counters opened (0 if none could be)
+int perf_start(void);
+
+/// Starts counting toward a phase, until perf_leave
+/// @param phase  the phase
+void perf_enter(perf_phase_t phase);
+
+/// Stops counting toward the phase perf_enter started
+void perf_leave(void);
+
+/// Prints what the phases of the expression just finished counted to
+/// standard error, and starts the next expression's counts
+void perf_expr_done(void);
+
+/// Prints the totals of every phase to standard error and closes the
+/// counters.  Also called at exit, so a fatal error still gets totals.
+void perf_stop(void);
+
+#endif
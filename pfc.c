@@ -0,0 +1,493 @@
+/*
+ * pfc.c
+ *
+ * Writing, mapping and running precompiled postfix scripts
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "pfc.h"
+#include "symtab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HEADER_LEN 32
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Tags of the encoded tree nodes. Trees are stored in prefix order and an
+// interior node records the size of its left subtree so that the untaken
+// branch of a ternary can be skipped without decoding it.
+//
+//     INTEGER   tag value:i32
+//     SYMBOL    tag length:u32 name '\0'
+//     INTERIOR  tag op:u8 left-length:u32 left right
+enum { TAG_INTEGER, TAG_SYMBOL, TAG_INTERIOR };
+
+// Growable byte buffer used to encode one record
+typedef struct buffer_s {
+	unsigned char *data;
+	size_t len;
+	size_t cap;
+} buffer_t;
+
+static buffer_t buf = { NULL, 0, 0 };
+
+/// Hashes bytes into a running FNV-1a checksum
+///
+/// @param hash The checksum so far
+/// @param data The bytes to add
+/// @param len The number of bytes
+/// @return The new checksum
+static unsigned long long fnv1a(unsigned long long hash, const unsigned char *data, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/// Stores a 32 bit little endian integer
+///
+/// @param dest Where to store it
+/// @param val The value
+static void put_u32(unsigned char *dest, unsigned long val) {
+	for (int i = 0; i < 4; i++) {
+		dest[i] = (unsigned char) (val >> (8 * i));
+	}
+}
+
+/// Stores a 64 bit little endian integer
+///
+/// @param dest Where to store it
+/// @param val The value
+static void put_u64(unsigned char *dest, unsigned long long val) {
+	for (int i = 0; i < 8; i++) {
+		dest[i] = (unsigned char) (val >> (8 * i));
+	}
+}
+
+/// Loads a 32 bit little endian integer
+///
+/// @param src Where to load it from
+/// @return The value
+static unsigned long get_u32(const unsigned char *src) {
+	return (unsigned long) src[0] | (unsigned long) src[1] << 8 |
+		(unsigned long) src[2] << 16 | (unsigned long) src[3] << 24;
+}
+
+/// Loads a 64 bit little endian integer
+///
+/// @param src Where to load it from
+/// @return The value
+static unsigned long long get_u64(const unsigned char *src) {
+	return (unsigned long long) get_u32(src) | (unsigned long long) get_u32(src + 4) << 32;
+}
+
+/// Makes room for more bytes at the end of the scratch buffer
+///
+/// @param len The number of bytes needed
+/// @return Where to write them
+static unsigned char *reserve(size_t len) {
+	if (buf.len + len > buf.cap) {
+		size_t cap = buf.cap ? buf.cap : 256;
+		while (cap < buf.len + len) {
+			cap *= 2;
+		}
+		unsigned char *data = (unsigned char *) realloc(buf.data, cap);
+		if (data == NULL) { // Check if realloc failed
+			fprintf(stderr, "Error: compiled script memory allocation failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		buf.data = data;
+		buf.cap = cap;
+	}
+
+	unsigned char *dest = buf.data + buf.len;
+	buf.len += len;
+	return dest;
+}
+
+/// Appends the encoding of a tree to the scratch buffer
+///
+/// @param node The tree to encode
+static void encode(tree_node_t *node) {
+	if (node->type == LEAF) {
+		if (((leaf_node_t *) node->node)->exp_type == INTEGER) {
+			unsigned char *dest = reserve(5);
+			dest[0] = TAG_INTEGER;
+			put_u32(dest + 1, (unsigned long) (int) strtol(node->token, NULL, 10));
+		} else {
+			size_t len = strlen(node->token);
+			unsigned char *dest = reserve(5 + len + 1);
+			dest[0] = TAG_SYMBOL;
+			put_u32(dest + 1, len);
+			memcpy(dest + 5, node->token, len + 1);
+		}
+	} else {
+		interior_node_t *interior = (interior_node_t *) node->node;
+		size_t at = buf.len;
+		unsigned char *dest = reserve(6);
+		dest[0] = TAG_INTERIOR;
+		dest[1] = (unsigned char) interior->op;
+
+		encode(interior->left);
+		put_u32(buf.data + at + 2, buf.len - at - 6); // The buffer may have moved
+		encode(interior->right);
+	}
+}
+
+/// Writes the scratch buffer out as the next record
+///
+/// @param writer The script being written
+static void flush_record(pfc_writer_t *writer) {
+	if (fwrite(buf.data, 1, buf.len, writer->file) != buf.len) {
+		perror(writer->filename);
+		exit(EXIT_FAILURE);
+	}
+	writer->hash = fnv1a(writer->hash, buf.data, buf.len);
+	writer->length += buf.len;
+	writer->records++;
+	buf.len = 0;
+}
+
+/// Creates a compiled script file
+///
+/// @param filename The file to create
+/// @return The writer
+pfc_writer_t *pfc_create(char *filename) {
+	pfc_writer_t *writer = (pfc_writer_t *) malloc(sizeof(pfc_writer_t));
+	if (writer == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: compiled script memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	writer->file = fopen(filename, "wb");
+	if (writer->file == NULL) { // Check if file open failed
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	writer->filename = filename;
+	writer->records = 0;
+	writer->length = 0;
+	writer->hash = FNV_OFFSET;
+
+	// Leave room for the header, it is filled in by pfc_close
+	unsigned char header[HEADER_LEN] = { 0 };
+	if (fwrite(header, 1, HEADER_LEN, writer->file) != HEADER_LEN) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+
+	return writer;
+}
+
+/// Adds a record for a line that only prompts
+///
+/// @param writer The script being written
+void pfc_write_prompt(pfc_writer_t *writer) {
+	*reserve(1) = PFC_PROMPT;
+	flush_record(writer);
+}
+
+/// Adds a record for a line that failed to parse
+///
+/// @param writer The script being written
+/// @param error Why it failed
+void pfc_write_error(pfc_writer_t *writer, parse_error_t error) {
+	unsigned char *dest = reserve(2);
+	dest[0] = PFC_PARSE_ERROR;
+	dest[1] = (unsigned char) error;
+	flush_record(writer);
+}
+
+/// Adds a record for a scope command
+///
+/// @param writer The script being written
+/// @param op The command
+void pfc_write_scope(pfc_writer_t *writer, scope_op_t op) {
+	unsigned char *dest = reserve(2);
+	dest[0] = PFC_SCOPE;
+	dest[1] = (unsigned char) op;
+	flush_record(writer);
+}
+
+/// Adds a record for a dump command
+///
+/// @param writer The script being written
+/// @param line The command
+void pfc_write_dump(pfc_writer_t *writer, char *line) {
+	size_t len = strlen(line);
+	unsigned char *dest = reserve(5 + len);
+	dest[0] = PFC_DUMP;
+	put_u32(dest + 1, len);
+	memcpy(dest + 5, line, len);
+	flush_record(writer);
+}
+
+/// Adds a record for a parsed expression
+///
+/// @param writer The script being written
+/// @param root The parse tree of the expression
+void pfc_write_expr(pfc_writer_t *writer, tree_node_t *root) {
+	char *infix = NULL;
+	size_t infix_len = 0;
+	FILE *out = open_memstream(&infix, &infix_len);
+	if (out == NULL) {
+		fprintf(stderr, "Error: compiled script memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	fprint_infix(out, root);
+	fclose(out);
+
+	unsigned char *dest = reserve(5 + infix_len);
+	dest[0] = PFC_EXPR;
+	put_u32(dest + 1, infix_len);
+	memcpy(dest + 5, infix, infix_len);
+	free(infix);
+
+	size_t at = buf.len;
+	reserve(4);
+	encode(root);
+	put_u32(buf.data + at, buf.len - at - 4);
+	flush_record(writer);
+}
+
+/// Writes the header and closes the file
+///
+/// @param writer The script being written
+void pfc_close(pfc_writer_t *writer) {
+	unsigned char header[HEADER_LEN];
+	memcpy(header, "PFCS", 4);
+	put_u32(header + 4, PFC_VERSION);
+	put_u64(header + 8, writer->records);
+	put_u64(header + 16, writer->length);
+	put_u64(header + 24, fnv1a(writer->hash, header, 24));
+
+	if (fseek(writer->file, 0, SEEK_SET) != 0 ||
+		fwrite(header, 1, HEADER_LEN, writer->file) != HEADER_LEN ||
+		fclose(writer->file) != 0) {
+		perror(writer->filename);
+		exit(EXIT_FAILURE);
+	}
+
+	free(writer);
+	free(buf.data);
+	buf.data = NULL;
+	buf.len = buf.cap = 0;
+}
+
+/// Rejects a compiled script
+///
+/// @param filename The file being opened
+/// @param why What is wrong with it
+static void reject(char *filename, char *why) {
+	fprintf(stderr, "Error: %s %s.\n", filename, why);
+	exit(EXIT_FAILURE);
+}
+
+/// Maps a compiled script and verifies its header and checksum
+///
+/// @param filename The file to open
+/// @return The image, positioned at the first record
+pfc_image_t *pfc_open(char *filename) {
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) { // Check if file open failed
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	if ((size_t) st.st_size < HEADER_LEN) {
+		reject(filename, "is not a compiled script");
+	}
+
+	unsigned char *map = (unsigned char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	if (memcmp(map, "PFCS", 4) != 0) {
+		reject(filename, "is not a compiled script");
+	}
+	if (get_u32(map + 4) != PFC_VERSION) {
+		reject(filename, "was compiled by an incompatible version, recompile it");
+	}
+	if (get_u64(map + 16) != (unsigned long long) st.st_size - HEADER_LEN) {
+		reject(filename, "is truncated or corrupt");
+	}
+	unsigned long long hash = fnv1a(FNV_OFFSET, map + HEADER_LEN, st.st_size - HEADER_LEN);
+	if (fnv1a(hash, map, 24) != get_u64(map + 24)) {
+		reject(filename, "failed its checksum");
+	}
+
+	pfc_image_t *image = (pfc_image_t *) malloc(sizeof(pfc_image_t));
+	if (image == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: compiled script memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	image->map = map;
+	image->size = st.st_size;
+	image->pos = map + HEADER_LEN;
+	image->end = map + st.st_size;
+	image->filename = filename;
+
+	return image;
+}
+
+/// Reads the next record of an image
+///
+/// @param image The image
+/// @param record Filled in with the record
+/// @return 0 at the end of the image, non-zero otherwise
+int pfc_next(pfc_image_t *image, pfc_record_t *record) {
+	const unsigned char *pos = image->pos;
+	size_t left = image->end - pos;
+	if (left == 0) {
+		return 0;
+	}
+
+	record->kind = (pfc_kind_t) pos[0];
+	switch (record->kind) {
+		case PFC_PROMPT:
+			image->pos = pos + 1;
+			return 1;
+		case PFC_PARSE_ERROR:
+			if (left < 2) break;
+			record->error = (parse_error_t) pos[1];
+			image->pos = pos + 2;
+			return 1;
+		case PFC_SCOPE:
+			if (left < 2 || pos[1] > SCOPE_COMMIT) break;
+			record->scope = (scope_op_t) pos[1];
+			image->pos = pos + 2;
+			return 1;
+		case PFC_DUMP: {
+			if (left < 5) break;
+			size_t text_len = get_u32(pos + 1);
+			if (text_len > left - 5) break;
+			record->text = (const char *) pos + 5;
+			record->text_len = text_len;
+			image->pos = pos + 5 + text_len;
+			return 1;
+		}
+		case PFC_EXPR: {
+			if (left < 9) break;
+			size_t infix_len = get_u32(pos + 1);
+			if (infix_len > left - 9) break;
+			size_t code_len = get_u32(pos + 5 + infix_len);
+			if (code_len > left - 9 - infix_len) break;
+			record->infix = (const char *) pos + 5;
+			record->infix_len = infix_len;
+			record->code = pos + 9 + infix_len;
+			image->pos = record->code + code_len;
+			return 1;
+		}
+	}
+
+	reject(image->filename, "is truncated or corrupt");
+	return 0;
+}
+
+/// Evaluates an encoded tree exactly as eval_tree would
+///
+/// @param code The encoded tree
+/// @return The value, or -1 with error_flag set on failure
+int pfc_eval(const unsigned char *code) {
+	if (error_flag) {
+		return -1; // Terminate if an error has occurred
+	}
+
+	switch (code[0]) {
+		case TAG_INTEGER:
+			return (int) get_u32(code + 1);
+		case TAG_SYMBOL: {
+			symbol_t *symbol = lookup_table((char *) code + 5);
+			if (symbol == NULL) {
+				eval_fail(UNDEFINED_SYMBOL);
+				return -1;
+			}
+			return get_symbol_val(symbol);
+		}
+		case TAG_INTERIOR:
+			break;
+		default:
+			eval_fail(UNKNOWN_EXP_TYPE);
+			return -1;
+	}
+
+	op_type_t op = (op_type_t) code[1];
+	const unsigned char *left = code + 6;
+	const unsigned char *right = left + get_u32(code + 2);
+
+	if (op == ASSIGN_OP) {
+		if (left[0] != TAG_SYMBOL) {
+			eval_fail(INVALID_LVALUE);
+			return -1;
+		}
+		int val = pfc_eval(right);
+		if (error_flag) {
+			return -1; // Propagate error
+		}
+		if (bind_symbol((char *) left + 5, val) == NULL) {
+			eval_fail(SYMTAB_FULL);
+			return -1;
+		}
+		return val;
+	}
+
+	if (op == Q_OP) {
+		int test_val = pfc_eval(left);
+		if (error_flag) {
+			return -1; // Propagate error
+		}
+		// right is the ALT node holding both alternatives
+		const unsigned char *alt_left = right + 6;
+		return pfc_eval(test_val ? alt_left : alt_left + get_u32(right + 2));
+	}
+
+	int left_val = pfc_eval(left);
+	if (error_flag) {
+		return -1; // Propagate error
+	}
+	int right_val = pfc_eval(right);
+	if (error_flag) {
+		return -1; // Propagate error
+	}
+
+	switch (op) {
+		case ADD_OP: return left_val + right_val;
+		case SUB_OP: return left_val - right_val;
+		case MUL_OP: return left_val * right_val;
+		case DIV_OP:
+			if (right_val == 0) {
+				eval_fail(DIVISION_BY_ZERO);
+				return -1;
+			}
+			return left_val / right_val;
+		case MOD_OP:
+			if (right_val == 0) {
+				eval_fail(DIVISION_BY_ZERO);
+				return -1;
+			}
+			return left_val % right_val;
+		default:
+			eval_fail(UNKNOWN_OPERATION);
+			return -1;
+	}
+}
+
+/// Unmaps an image
+///
+/// @param image The image
+void pfc_unmap(pfc_image_t *image) {
+	munmap(image->map, image->size);
+	free(image);
+}
@@ -0,0 +1,122 @@
+/// Precompiled postfix scripts (.pfc)
+///
+/// A compiled script holds one record per input line, in order, so
+/// that running it produces exactly what feeding the text script to
+/// interp would.  Expressions are stored already parsed, along with
+/// their infix text, so running a script never tokenizes or parses.
+///
+/// Layout (all integers little endian):
+///
+///     header:  "PFCS" version:u32 records:u64 length:u64 checksum:u64
+///     payload: length bytes of records
+///
+/// The checksum is a 64 bit FNV-1a hash of the payload followed by
+/// the first 24 bytes of the header.
+
+#ifndef PFC_H
+#define PFC_H
+
+#include <stddef.h>
+#include "parser.h"
+
+#define PFC_VERSION 3           // bump whenever the layout changes
+
+// The kinds of records in a compiled script
+typedef enum pfc_kind_e {
+    PFC_PROMPT,                 // comment or blank line, only prompts
+    PFC_EXPR,                   // a parsed expression
+    PFC_PARSE_ERROR,            // a line that failed to parse
+    PFC_SCOPE,                  // a scope command
+    PFC_DUMP                    // a dump command
+} pfc_kind_t;
+
+// A compiled script being written
+typedef struct pfc_writer_s {
+    FILE *file;                 // the output file
+    char *filename;             // its name, for error messages
+    unsigned long long records; // records written so far
+    unsigned long long length;  // payload bytes written so far
+    unsigned long long hash;    // running checksum of the payload
+} pfc_writer_t;
+
+// A compiled script mapped into memory for running
+typedef struct pfc_image_s {
+    unsigned char *map;         // the mapped file
+    size_t size;                // size of the mapping
+    const unsigned char *pos;   // the next record
+    const unsigned char *end;   // end of the payload
+    char *filename;             // the file name, for error messages
+} pfc_image_t;
+
+// One record read back from an image
+typedef struct pfc_record_s {
+    pfc_kind_t kind;            // the kind of record
+    parse_error_t error;        // the parse error (PFC_PARSE_ERROR)
+    scope_op_t scope;           // the scope command (PFC_SCOPE)
+    const char *infix;          // infix text to echo (PFC_EXPR)
+    size_t infix_len;           // length of the infix text
+    const char *text;           // the command line (PFC_DUMP)
+    size_t text_len;            // length of the command line
+    const unsigned char *code;  // the encoded tree (PFC_EXPR)
+} pfc_record_t;
+
+/// Creates a compiled script file
+/// @param filename  the file to create
+/// @return the writer
+/// @exception If the file can't be created, an error message is
+///     displayed and the program exits with EXIT_FAILURE.
+pfc_writer_t *pfc_create(char *filename);
+
+/// Adds a record for a line that only prompts
+/// @param writer  the script being written
+void pfc_write_prompt(pfc_writer_t *writer);
+
+/// Adds a record for a line that failed to parse
+/// @param writer  the script being written
+/// @param error  why it failed
+void pfc_write_error(pfc_writer_t *writer, parse_error_t error);
+
+/// Adds a record for a scope command
+/// @param writer  the script being written
+/// @param op  the command
+void pfc_write_scope(pfc_writer_t *writer, scope_op_t op);
+
+/// Adds a record for a dump command, kept as the text of its line
+/// @param writer  the script being written
+/// @param line  the command
+void pfc_write_dump(pfc_writer_t *writer, char *line);
+
+/// Adds a record for a parsed expression
+/// @param writer  the script being written
+/// @param root  the parse tree of the expression
+void pfc_write_expr(pfc_writer_t *writer, tree_node_t *root);
+
+/// Writes the header and closes the file
+/// @param writer  the script being written (freed)
+void pfc_close(pfc_writer_t *writer);
+
+/// Maps a compiled script and verifies its header and checksum
+/// @param filename  the file to open
+/// @return the image, positioned at the first record
+/// @exception If the file can't be read, is not a compiled script,
+///     has another version or fails its checksum, an error message
+///     is displayed and the program exits with EXIT_FAILURE.
+pfc_image_t *pfc_open(char *filename);
+
+/// Reads the next record of an image
+/// @param image  the image
+/// @param record  filled in with the record
+/// @return 0 at the end of the image, non-zero otherwise
+int pfc_next(pfc_image_t *image, pfc_record_t *record);
+
+/// Evaluates an encoded tree exactly as eval_tree would evaluate
+/// the tree it was compiled from
+/// @param code  the code of a PFC_EXPR record
+/// @return the value, or -1 with error_flag set on failure
+int pfc_eval(const unsigned char *code);
+
+/// Unmaps an image
+/// @param image  the image (freed)
+void pfc_unmap(pfc_image_t *image);
+
+#endif
@@ -0,0 +1,597 @@
+/*
+ * shmtab.c
+ *
+ * Shared memory symbol tables. Each process keeps its own symbol_t
+ * proxies for the entries it has looked up; a proxy's name points into
+ * the segment's name pool and its value lives in the segment.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "shmtab.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_READY 1             // header state once the creator has loaded the table
+
+// The start of the segment
+typedef struct shm_header_s {
+	char magic[4];          // "PFSM"
+	uint32_t version;       // SHM_VERSION
+	uint32_t state;         // 0 while loading, then SHM_READY
+	uint32_t buckets;       // number of hash buckets (a power of two)
+	uint32_t max_entries;   // number of entries there is room for
+	uint32_t entries;       // number of entries handed out
+	uint32_t newest;        // newest entry + 1, 0 if there are none
+	uint64_t pool_size;     // bytes in the name pool
+	uint64_t pool_used;     // bytes of the name pool handed out
+} shm_header_t;
+
+// One symbol (indices are stored + 1 so that 0 can end a chain)
+typedef struct shm_entry_s {
+	int val;                // the value, only accessed atomically
+	uint32_t name;          // offset of the name in the pool
+	uint32_t chain;         // next entry in the same bucket + 1
+	uint32_t older;         // next older entry + 1
+} shm_entry_t;
+
+// A mapped segment
+struct shmtab_s {
+	unsigned char *map;     // the mapping
+	size_t size;            // size of the mapping
+	shm_header_t *header;   // the header, at the start of the mapping
+	uint32_t *buckets;      // heads of the hash chains
+	shm_entry_t *entries;   // the entries
+	char *pool;             // the name pool
+	symbol_t **proxies;     // this process's proxy for each entry, or NULL
+	pthread_mutex_t spare_lock; // guards the spares
+	uint32_t spare_entry;   // an entry this process claimed but never published + 1, or 0
+	uint32_t spare_name;    // offset of name pool bytes it claimed but never used
+	uint32_t spare_len;     // how many, 0 if none
+	uint32_t listed;        // the newest entry + 1 shmtab_new_symbols has listed, 0 for none
+};
+
+/// Hashes a name (32 bit FNV-1a)
+///
+/// @param name The name
+/// @return The hash
+static uint32_t hash_name(const char *name) {
+	uint32_t hash = 2166136261u;
+	for (; *name != '\0'; name++) {
+		hash ^= (unsigned char) *name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/// Works out where each part of a segment lives
+///
+/// @param shm The table, with map set
+static void locate_parts(shmtab_t *shm) {
+	shm->header = (shm_header_t *) shm->map;
+	shm->buckets = (uint32_t *) (shm->map + sizeof(shm_header_t));
+	shm->entries = (shm_entry_t *) (shm->buckets + shm->header->buckets);
+	shm->pool = (char *) (shm->entries + shm->header->max_entries);
+}
+
+/// Sizes a segment
+///
+/// @param buckets The number of hash buckets
+/// @param max_entries The number of entries
+/// @param pool_size The number of name pool bytes
+/// @return The size of the segment in bytes
+static size_t segment_size(uint32_t buckets, uint32_t max_entries, uint64_t pool_size) {
+	return sizeof(shm_header_t) + buckets * sizeof(uint32_t) + max_entries * sizeof(shm_entry_t) + pool_size;
+}
+
+/// Returns this process's proxy for an entry, making it if needed
+///
+/// @param shm The table
+/// @param index The index of the entry
+/// @return The proxy
+static symbol_t *proxy(shmtab_t *shm, uint32_t index) {
+	symbol_t *symbol = __atomic_load_n(&shm->proxies[index], __ATOMIC_ACQUIRE);
+	if (symbol != NULL) {
+		return symbol;
+	}
+
+	symbol = (symbol_t *) malloc(sizeof(symbol_t));
+	if (symbol == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: symbol memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	symbol->var_name = shm->pool + shm->entries[index].name;
+	symbol->val = 0;
+	symbol->depth = 0;
+	symbol->shared = &shm->entries[index].val;
+	symbol->outer = NULL;
+	symbol->next = NULL;
+
+	symbol_t *expected = NULL;
+	if (!__atomic_compare_exchange_n(&shm->proxies[index], &expected, symbol, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(symbol); // Another thread made one first
+		return expected;
+	}
+	return symbol;
+}
+
+/// Searches a hash chain from first up to (not including) last
+///
+/// @param shm The table
+/// @param first The first entry + 1
+/// @param last The entry + 1 to stop at, or 0 for the end of the chain
+/// @param name The name to look for
+/// @return The index of the entry + 1, or 0 if not found
+static uint32_t search_chain(shmtab_t *shm, uint32_t first, uint32_t last, char *name) {
+	for (uint32_t at = first; at != last; at = shm->entries[at - 1].chain) {
+		if (strcmp(shm->pool + shm->entries[at - 1].name, name) == 0) {
+			return at;
+		}
+	}
+	return 0;
+}
+
+/// Looks a symbol up in a shared table
+///
+/// @param shm The table
+/// @param name The name of the variable
+/// @return The proxy for the symbol, or NULL if not found
+symbol_t *shmtab_lookup(shmtab_t *shm, char *name) {
+	uint32_t *bucket = &shm->buckets[hash_name(name) & (shm->header->buckets - 1)];
+	uint32_t at = search_chain(shm, __atomic_load_n(bucket, __ATOMIC_ACQUIRE), 0, name);
+	return at ? proxy(shm, at - 1) : NULL;
+}
+
+/// Claims an entry, reusing this process's spare one if it has one
+///
+/// @param shm The table
+/// @return The index of the entry + 1, or 0 if every entry is taken
+static uint32_t claim_entry(shmtab_t *shm) {
+	pthread_mutex_lock(&shm->spare_lock);
+	uint32_t at = shm->spare_entry;
+	shm->spare_entry = 0;
+	pthread_mutex_unlock(&shm->spare_lock);
+	if (at != 0) {
+		return at;
+	}
+
+	// Only counts up while there is room, so entries never exceeds max_entries
+	uint32_t *entries = &shm->header->entries;
+	uint32_t index = __atomic_load_n(entries, __ATOMIC_RELAXED);
+	do {
+		if (index >= shm->header->max_entries) {
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(entries, &index, index + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return index + 1;
+}
+
+/// Claims room in the name pool, reusing this process's spare room if
+/// it is big enough
+///
+/// @param shm The table
+/// @param len The number of bytes
+/// @param offset Set to the offset of the room
+/// @param room Set to the number of bytes claimed (at least len)
+/// @return 1 if it was claimed, 0 if the pool is full
+static int claim_name(shmtab_t *shm, size_t len, uint32_t *offset, uint32_t *room) {
+	pthread_mutex_lock(&shm->spare_lock);
+	if (shm->spare_len >= len) {
+		*offset = shm->spare_name;
+		*room = shm->spare_len;
+		shm->spare_len = 0;
+		pthread_mutex_unlock(&shm->spare_lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&shm->spare_lock);
+
+	uint64_t *pool_used = &shm->header->pool_used;
+	uint64_t used = __atomic_load_n(pool_used, __ATOMIC_RELAXED);
+	do {
+		if (used + len > shm->header->pool_size) {
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(pool_used, &used, used + len, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	*offset = (uint32_t) used;
+	*room = (uint32_t) len;
+	return 1;
+}
+
+/// Keeps an entry and name pool room that were claimed but not used for
+/// this process's next new symbol.  Only one of each is kept; with
+/// several threads adding symbols at once, another may be lost.
+///
+/// @param shm The table
+/// @param at The index of the entry + 1, or 0 for none
+/// @param offset The offset of the room
+/// @param room The number of bytes of room, or 0 for none
+static void keep_spares(shmtab_t *shm, uint32_t at, uint32_t offset, uint32_t room) {
+	pthread_mutex_lock(&shm->spare_lock);
+	if (at != 0 && shm->spare_entry == 0) {
+		shm->spare_entry = at;
+	}
+	if (room > shm->spare_len) {
+		shm->spare_name = offset;
+		shm->spare_len = room;
+	}
+	pthread_mutex_unlock(&shm->spare_lock);
+}
+
+/// Binds a value to a name in a shared table, adding it if needed
+///
+/// @param shm The table
+/// @param name The name of the variable
+/// @param val The value to bind
+/// @return The proxy for the symbol, or NULL if the table is full
+symbol_t *shmtab_bind(shmtab_t *shm, char *name, int val) {
+	shm_header_t *header = shm->header;
+	uint32_t *bucket = &shm->buckets[hash_name(name) & (header->buckets - 1)];
+	uint32_t seen = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+	uint32_t at = search_chain(shm, seen, 0, name);
+	if (at != 0) {
+		__atomic_store_n(&shm->entries[at - 1].val, val, __ATOMIC_RELEASE);
+		return proxy(shm, at - 1);
+	}
+
+	// Claim an entry and room for the name; what goes unused is kept for the next new symbol
+	size_t len = strlen(name) + 1;
+	uint32_t offset;
+	uint32_t room;
+	uint32_t claimed = claim_entry(shm);
+	if (claimed == 0) {
+		return NULL;
+	}
+	if (!claim_name(shm, len, &offset, &room)) {
+		keep_spares(shm, claimed, 0, 0);
+		return NULL;
+	}
+	uint32_t index = claimed - 1;
+	shm_entry_t *entry = &shm->entries[index];
+	memcpy(shm->pool + offset, name, len);
+	entry->name = offset;
+	entry->val = val;
+
+	// Publish it in its bucket, unless another process adds the same name first
+	uint32_t old_head = seen;
+	for (;;) {
+		entry->chain = old_head;
+		if (__atomic_compare_exchange_n(bucket, &old_head, index + 1, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		at = search_chain(shm, old_head, seen, name);
+		if (at != 0) {
+			keep_spares(shm, claimed, offset, room);
+			__atomic_store_n(&shm->entries[at - 1].val, val, __ATOMIC_RELEASE);
+			return proxy(shm, at - 1);
+		}
+		seen = old_head;
+	}
+
+	// Then in the insertion order list, for dumps
+	uint32_t newest = __atomic_load_n(&header->newest, __ATOMIC_RELAXED);
+	do {
+		entry->older = newest;
+	} while (!__atomic_compare_exchange_n(&header->newest, &newest, index + 1, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return proxy(shm, index);
+}
+
+/// Prints every symbol of a shared table, newest first
+///
+/// @param shm The table
+void shmtab_dump(shmtab_t *shm) {
+	uint32_t at = __atomic_load_n(&shm->header->newest, __ATOMIC_ACQUIRE);
+	while (at != 0) {
+		shm_entry_t *entry = &shm->entries[at - 1];
+		printf("\tName: %s, Value: %d\n", shm->pool + entry->name, __atomic_load_n(&entry->val, __ATOMIC_ACQUIRE));
+		at = entry->older;
+	}
+}
+
+/// Lists the symbols added since the last call
+///
+/// @param shm The table
+/// @param count Set to the number of symbols
+/// @return The symbols (the array must be freed)
+symbol_t **shmtab_new_symbols(shmtab_t *shm, size_t *count) {
+	symbol_t **symbols = NULL;
+	size_t cap = 0;
+	*count = 0;
+	uint32_t newest = __atomic_load_n(&shm->header->newest, __ATOMIC_ACQUIRE);
+	for (uint32_t at = newest; at != shm->listed; at = shm->entries[at - 1].older) {
+		if (*count == cap) {
+			cap = cap ? cap * 2 : 64;
+			symbol_t **bigger = (symbol_t **) realloc(symbols, cap * sizeof(symbol_t *));
+			if (bigger == NULL) { // Check if realloc failed
+				fprintf(stderr, "Error: symbol memory allocation failed.\n");
+				exit(EXIT_FAILURE);
+			}
+			symbols = bigger;
+		}
+		symbols[(*count)++] = proxy(shm, at - 1);
+	}
+	shm->listed = newest; // Entries are only ever added in front of it
+	return symbols;
+}
+
+/// Allocates the process local part of a table
+///
+/// @param map The mapped segment
+/// @param size The size of the mapping
+/// @return The table
+static shmtab_t *new_shmtab(unsigned char *map, size_t size) {
+	shmtab_t *shm = (shmtab_t *) malloc(sizeof(shmtab_t));
+	if (shm == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: symbol memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	shm->map = map;
+	shm->size = size;
+	pthread_mutex_init(&shm->spare_lock, NULL);
+	shm->spare_entry = 0;
+	shm->spare_name = 0;
+	shm->spare_len = 0;
+	shm->listed = 0;
+	locate_parts(shm);
+
+	// Untouched pages of this stay unallocated, so it costs little for big tables
+	shm->proxies = (symbol_t **) calloc(shm->header->max_entries ? shm->header->max_entries : 1, sizeof(symbol_t *));
+	if (shm->proxies == NULL) { // Check if calloc failed
+		fprintf(stderr, "Error: symbol memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	return shm;
+}
+
+/// Locks a new segment until it is ready, before anything else is done
+/// to it, so that if this process dies the rest can tell. The lock goes
+/// when fd is closed or the process exits, however it exits, and unlike
+/// a pid it means the same thing in every pid namespace.
+///
+/// @param name The name of the segment
+/// @param fd The new, empty segment
+static void claim_segment(char *name, int fd) {
+	// Sized only once it is locked, so a segment with a header and no lock is stale
+	if (flock(fd, LOCK_EX) != 0 || ftruncate(fd, sizeof(shm_header_t)) != 0) {
+		perror(name);
+		shm_unlink(name);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// Creates a segment and copies the private table into it
+///
+/// @param name The name of the segment
+/// @param fd The new segment, claimed by claim_segment (close it once
+///     the table is returned, to let the rest use it)
+/// @return The table
+static shmtab_t *create_segment(char *name, int fd) {
+	// Oldest first, so that the shared table dumps in the same order
+	size_t count = 0;
+	uint64_t name_bytes = 0;
+	for (symbol_t *sym = newest_symbol(); sym != NULL; sym = sym->next) {
+		count++;
+		name_bytes += strlen(sym->var_name) + 1;
+	}
+	symbol_t **order = (symbol_t **) malloc((count ? count : 1) * sizeof(symbol_t *));
+	if (order == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: symbol memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t i = count;
+	for (symbol_t *sym = newest_symbol(); sym != NULL; sym = sym->next) {
+		order[--i] = sym;
+	}
+
+	uint64_t max_entries = count + SHM_SPARE_SYMBOLS;
+	uint64_t buckets = 1;
+	while (buckets < 2 * max_entries) {
+		buckets *= 2;
+	}
+	uint64_t pool_size = name_bytes + (uint64_t) SHM_SPARE_SYMBOLS * SHM_SPARE_NAME_LEN;
+	if (buckets > UINT32_MAX || pool_size > UINT32_MAX) {
+		fprintf(stderr, "Error: Symbol table is too big to share.\n");
+		shm_unlink(name);
+		exit(EXIT_FAILURE);
+	}
+
+	size_t size = segment_size(buckets, max_entries, pool_size);
+	if (ftruncate(fd, size) != 0) {
+		perror(name);
+		shm_unlink(name);
+		exit(EXIT_FAILURE);
+	}
+	unsigned char *map = (unsigned char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror(name);
+		shm_unlink(name);
+		exit(EXIT_FAILURE);
+	}
+
+	// ftruncate zero filled it, so every chain is already empty (it was claimed before)
+	shm_header_t *header = (shm_header_t *) map;
+	memcpy(header->magic, "PFSM", 4);
+	header->version = SHM_VERSION;
+	header->buckets = (uint32_t) buckets;
+	header->max_entries = (uint32_t) max_entries;
+	header->pool_size = pool_size;
+
+	shmtab_t *shm = new_shmtab(map, size);
+	for (i = 0; i < count; i++) {
+		shmtab_bind(shm, order[i]->var_name, get_symbol_val(order[i]));
+	}
+	free(order);
+
+	__atomic_store_n(&header->state, SHM_READY, __ATOMIC_RELEASE); // Everyone else can start now
+	return shm;
+}
+
+/// Reports a segment that never became ready
+///
+/// @param name The name of the segment
+static void never_loaded(char *name) {
+	fprintf(stderr, "Error: Shared symbol table %s was never loaded. If no process is loading it, remove /dev/shm/%s.\n",
+		name, name + (name[0] == '/'));
+	exit(EXIT_FAILURE);
+}
+
+/// Removes a segment whose creator died before it was ready, unless
+/// another process already has. Those that find it stale at once take
+/// turns holding a lock on it, and only unlink the name while it still
+/// names that segment, so a new segment made meanwhile is never removed.
+///
+/// @param name The name of the segment
+/// @param fd The stale segment
+static void remove_stale(char *name, int fd) {
+	struct stat stale;
+	struct stat current;
+	if (flock(fd, LOCK_EX) != 0 || fstat(fd, &stale) != 0) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	int named = shm_open(name, O_RDONLY, 0);
+	if (named >= 0) {
+		if (fstat(named, &current) == 0 && current.st_dev == stale.st_dev && current.st_ino == stale.st_ino) {
+			fprintf(stderr, "Warning: the process loading shared symbol table %s died, so it is loaded again.\n", name);
+			shm_unlink(name);
+		}
+		close(named);
+	}
+	flock(fd, LOCK_UN);
+}
+
+/// Maps a segment another process created, once it is ready
+///
+/// @param name The name of the segment
+/// @param fd The segment
+/// @return The table, or NULL if its creator died before it was ready
+static shmtab_t *map_segment(char *name, int fd) {
+	struct timespec pause = { 0, 1000000L };
+	time_t give_up = time(NULL) + SHM_WAIT_SECONDS;
+	struct stat st;
+
+	// The creator locks it first, sizes it next and marks it ready last
+	for (;;) {
+		if (fstat(fd, &st) != 0) {
+			perror(name);
+			exit(EXIT_FAILURE);
+		}
+		if ((size_t) st.st_size >= sizeof(shm_header_t)) {
+			break;
+		}
+		if (time(NULL) > give_up) {
+			never_loaded(name); // Its creator died before even claiming it
+		}
+		nanosleep(&pause, NULL);
+	}
+
+	shm_header_t *header = (shm_header_t *) mmap(NULL, sizeof(shm_header_t), PROT_READ, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	while (__atomic_load_n(&header->state, __ATOMIC_ACQUIRE) != SHM_READY) {
+		if (flock(fd, LOCK_SH | LOCK_NB) == 0) {
+			// Nobody holds the creator's lock, so unless it finished just now, it died
+			int ready = __atomic_load_n(&header->state, __ATOMIC_ACQUIRE) == SHM_READY;
+			flock(fd, LOCK_UN);
+			if (!ready) {
+				munmap(header, sizeof(shm_header_t));
+				return NULL;
+			}
+			break;
+		}
+		if (errno != EWOULDBLOCK) {
+			perror(name);
+			exit(EXIT_FAILURE);
+		}
+		if (time(NULL) > give_up) {
+			never_loaded(name);
+		}
+		nanosleep(&pause, NULL);
+	}
+	munmap(header, sizeof(shm_header_t));
+
+	// Sized before it was ready, so this is its full size
+	if (fstat(fd, &st) != 0) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	unsigned char *map = (unsigned char *) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	header = (shm_header_t *) map;
+	if (memcmp(header->magic, "PFSM", 4) != 0 || header->version != SHM_VERSION ||
+		segment_size(header->buckets, header->max_entries, header->pool_size) != (size_t) st.st_size) {
+		fprintf(stderr, "Error: %s is not a shared symbol table of this version.\n", name);
+		exit(EXIT_FAILURE);
+	}
+	return new_shmtab(map, st.st_size);
+}
+
+/// Makes the symbol table a shared memory table
+///
+/// @param name The name of the segment
+/// @param table The symbol table file, or NULL for an empty table
+/// @return 1 if an existing segment was attached, 0 if it was created
+int attach_shared_table(char *name, char *table) {
+	int loaded = 0;
+	shmtab_t *shm = NULL;
+	int attached;
+	while (shm == NULL) {
+		attached = 1;
+		int fd = shm_open(name, O_RDWR, 0);
+		if (fd < 0 && errno == ENOENT) {
+			// Load it privately first, so a bad table file never leaves a half made segment
+			if (table != NULL && !loaded) {
+				build_table(table);
+				loaded = 1;
+			}
+			fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+			if (fd >= 0) {
+				attached = 0;
+				claim_segment(name, fd);
+			} else if (errno == EEXIST) {
+				fd = shm_open(name, O_RDWR, 0); // Another process got there first
+			}
+		}
+		if (fd < 0) {
+			perror(name);
+			exit(EXIT_FAILURE);
+		}
+
+		shm = attached ? map_segment(name, fd) : create_segment(name, fd);
+		if (shm == NULL) {
+			remove_stale(name, fd); // Then try again, probably creating it this time
+		}
+		close(fd);
+	}
+	free_table(); // The private copy, if there was one
+	use_shared_table(shm);
+	return attached;
+}
+
+/// Unmaps a shared table
+///
+/// @param shm The table
+void shmtab_close(shmtab_t *shm) {
+	for (uint32_t i = 0; i < shm->header->max_entries; i++) {
+		free(shm->proxies[i]);
+	}
+	free(shm->proxies);
+	pthread_mutex_destroy(&shm->spare_lock);
+	munmap(shm->map, shm->size);
+	free(shm);
+}
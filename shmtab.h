@@ -0,0 +1,85 @@
+/// Symbol tables in POSIX shared memory (--shm NAME)
+///
+/// Many interp processes on one host can share a single copy of a
+/// symbol table.  The first process to ask for a segment loads the
+/// table file into it and marks it ready; later processes just map it.
+/// An assignment made by any process is seen by all of them.
+///
+/// The segment holds no pointers, only offsets and indices, so each
+/// process may map it at a different address:
+///
+///     header | buckets:u32[] | entries[] | name pool
+///
+/// Entries are chained from their hash bucket and, newest first, from
+/// the header in the order they were added.  Both chains and the value
+/// of each entry are only changed with atomic operations, so readers
+/// never lock and writers only retry a compare and swap.  Entries and
+/// names are never freed; once either runs out, new symbols can't be
+/// added and assignments to them fail with SYMTAB_FULL.
+///
+/// The segment outlives the processes using it.  Remove it with
+/// rm /dev/shm/NAME once the table should be loaded again.  If the
+/// process loading it dies first, the lock it held on the segment while
+/// loading goes with it, so the next process to attach can take that
+/// lock, removes the half loaded segment and loads it afresh.
+
+#ifndef SHMTAB_H
+#define SHMTAB_H
+
+#include <stddef.h>
+#include "symtab.h"
+
+#define SHM_VERSION 3           // bump whenever the layout changes
+#define SHM_SPARE_SYMBOLS 65536 // room for symbols beyond the table file
+#define SHM_SPARE_NAME_LEN 32   // name pool bytes allowed per spare symbol
+#define SHM_WAIT_SECONDS 60     // how long to wait for another process to load it
+
+typedef struct shmtab_s shmtab_t;
+
+/// Makes the symbol table a shared memory table.  If the segment does
+/// not exist yet, the table file is loaded into a new one; otherwise
+/// the existing one is mapped (waiting for the process loading it to
+/// finish) and the table file is not read.  A segment whose loading
+/// process died before finishing is removed and loaded again.
+/// @param name  the name of the segment, e.g. "/symbols"
+/// @param table  the symbol table file, or NULL for an empty table
+/// @return 1 if an existing segment was attached, 0 if it was created
+/// @exception If the segment can't be created or mapped, is not a
+///     symbol table, or never becomes ready, an error message is
+///     displayed and the program exits with EXIT_FAILURE.
+int attach_shared_table(char *name, char *table);
+
+/// Looks a symbol up in a shared table
+/// @param shm  the table
+/// @param name  the name of the variable
+/// @return a symbol_t standing for the entry (owned by the table and
+///     reused by later lookups), or NULL if not found
+symbol_t *shmtab_lookup(shmtab_t *shm, char *name);
+
+/// Binds a value to a variable in a shared table, adding it if needed
+/// @param shm  the table
+/// @param name  the name of the variable
+/// @param val  the value to bind
+/// @return the symbol holding the binding, or NULL if the table is full
+symbol_t *shmtab_bind(shmtab_t *shm, char *name, int val);
+
+/// Prints every symbol of a shared table, newest first, the way
+/// dump_table prints them
+/// @param shm  the table
+void shmtab_dump(shmtab_t *shm);
+
+/// Lists the symbols this process has not listed before, whichever
+/// process added them, newest first.  The first call lists them all.
+/// Takes time proportional to the number listed.  Only one thread may
+/// call it.
+/// @param shm  the table
+/// @param count  set to the number of symbols
+/// @return the symbols, owned by the table (the array must be freed,
+///     and may be NULL if there are none)
+symbol_t **shmtab_new_symbols(shmtab_t *shm, size_t *count);
+
+/// Unmaps a shared table (the segment itself is kept)
+/// @param shm  the table (freed)
+void shmtab_close(shmtab_t *shm);
+
+#endif
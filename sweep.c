@@ -0,0 +1,632 @@
+/*
+ * sweep.c
+ *
+ * Parallel parameter sweeps. The expression is flattened once into an
+ * array of nodes whose symbols are resolved to slots, then every worker
+ * thread evaluates it over its share of the points. Each worker owns a
+ * range of point numbers and takes chunks off the front of it; a worker
+ * that runs dry steals the back half of another worker's range.
+ * Divisors that can't change during the sweep get their magic numbers
+ * (see fastdiv.h) before it starts.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "sweep.h"
+#include "fastdiv.h"
+#include "parser.h"
+#include "symtab.h"
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_VARS 16             // most variables one sweep can range over
+#define CHUNK 4096              // points taken from a range at a time
+#define HIST_BUCKETS 64         // sign and bit length of the value
+#define NUM_ERRORS (SYMTAB_FULL + 1)
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef __int128 sum_t; // a billion points of 32 bit values overflow 64 bits
+#else
+typedef long long sum_t;
+#endif
+
+// The kinds of flattened nodes
+typedef enum sweep_kind_e {
+	SW_CONST,               // integer literal (value)
+	SW_VAR,                 // read of slot value
+	SW_ASSIGN,              // slot value = right
+	SW_BAD_ASSIGN,          // assignment to something that is not a symbol
+	SW_COND,                // left ? right : third
+	SW_BINARY               // left op right
+} sweep_kind_t;
+
+// One node of the flattened expression, children are indices
+typedef struct sweep_node_s {
+	sweep_kind_t kind;
+	op_type_t op;
+	int value;
+	int left;
+	int right;
+	int third;
+	fastdiv_t div;          // the divisor of a / or % if it can't change, d is 0 otherwise
+} sweep_node_t;
+
+// A swept variable
+typedef struct range_s {
+	char *name;
+	int lo;
+	int hi;
+	unsigned long long size;
+} range_t;
+
+// What one worker has found so far
+typedef struct stats_s {
+	unsigned long long count;                 // points that produced a value
+	unsigned long long errors[NUM_ERRORS];    // points that failed, by error
+	sum_t sum;
+	int min;
+	int max;
+	unsigned long long hist[HIST_BUCKETS];
+} stats_t;
+
+// A worker thread and the points it still owns
+typedef struct worker_s {
+	pthread_mutex_t lock;   // guards next and end
+	unsigned long long next;
+	unsigned long long end;
+	int *vals;              // slot values for the current point
+	unsigned char *bound;   // which slots are bound
+	stats_t stats;
+	pthread_t thread;
+	int id;
+} worker_t;
+
+// Everything the workers share (read only once they start)
+static struct {
+	sweep_node_t *nodes;
+	int num_nodes;
+	int root;
+	char **slot_names;
+	int *init_vals;
+	unsigned char *init_bound;
+	int num_slots;
+	int has_assign;
+	range_t ranges[MAX_VARS];
+	int num_ranges;
+	worker_t *workers;
+	int num_workers;
+} sweep;
+
+/// Reports a bad sweep specification and exits
+///
+/// @param why What is wrong with it
+static void bad_spec(char *why) {
+	fprintf(stderr, "Error: Invalid sweep, %s.\n", why);
+	exit(EXIT_FAILURE);
+}
+
+/// Parses one end of a range. Exponents are allowed (1e9), fractions are not.
+///
+/// @param text The number
+/// @return Its value
+static int parse_bound(char *text) {
+	char *end;
+	double val = strtod(text, &end);
+	if (end == text || *end != '\0' || val != floor(val) || val < INT_MIN || val > INT_MAX) {
+		bad_spec("range ends must be whole numbers that fit in an int");
+	}
+	return (int) val;
+}
+
+/// Parses "name=lo..hi,name=lo..hi" into sweep.ranges
+///
+/// @param spec The specification (modified)
+static void parse_spec(char *spec) {
+	char *save = NULL;
+	for (char *item = strtok_r(spec, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+		char *eq = strchr(item, '=');
+		char *dots = eq ? strstr(eq + 1, "..") : NULL;
+		if (eq == NULL || dots == NULL) {
+			bad_spec("expected name=lo..hi");
+		}
+		*eq = '\0';
+		*dots = '\0';
+		if (classify_token(item, strlen(item)) != TOKEN_SYMBOL) {
+			bad_spec("variable names must be symbols");
+		}
+		if (sweep.num_ranges == MAX_VARS) {
+			bad_spec("too many variables");
+		}
+		for (int i = 0; i < sweep.num_ranges; i++) {
+			if (strcmp(sweep.ranges[i].name, item) == 0) {
+				bad_spec("a variable is swept twice");
+			}
+		}
+
+		range_t *range = &sweep.ranges[sweep.num_ranges++];
+		range->name = item;
+		range->lo = parse_bound(eq + 1);
+		range->hi = parse_bound(dots + 2);
+		if (range->lo > range->hi) {
+			bad_spec("ranges must go from low to high");
+		}
+		range->size = (unsigned long long) ((long long) range->hi - range->lo) + 1;
+	}
+
+	if (sweep.num_ranges == 0) {
+		bad_spec("no variables given");
+	}
+}
+
+/// Finds or adds the slot for a symbol
+///
+/// @param name The symbol
+/// @return Its slot
+static int slot_of(char *name) {
+	for (int i = 0; i < sweep.num_slots; i++) {
+		if (strcmp(sweep.slot_names[i], name) == 0) {
+			return i;
+		}
+	}
+
+	int slot = sweep.num_slots++;
+	sweep.slot_names = (char **) realloc(sweep.slot_names, sweep.num_slots * sizeof(char *));
+	sweep.init_vals = (int *) realloc(sweep.init_vals, sweep.num_slots * sizeof(int));
+	sweep.init_bound = (unsigned char *) realloc(sweep.init_bound, sweep.num_slots);
+	if (sweep.slot_names == NULL || sweep.init_vals == NULL || sweep.init_bound == NULL) {
+		fprintf(stderr, "Error: sweep memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Everything but the swept variables starts from the symbol table
+	symbol_t *symbol = lookup_table(name);
+	sweep.slot_names[slot] = name;
+	sweep.init_vals[slot] = symbol ? get_symbol_val(symbol) : 0;
+	sweep.init_bound[slot] = symbol != NULL;
+	return slot;
+}
+
+/// Flattens a parse tree into sweep.nodes
+///
+/// @param node The tree to flatten
+/// @return The index of its node
+static int flatten(tree_node_t *node) {
+	sweep_node_t flat = { SW_CONST, NO_OP, 0, -1, -1, -1, { 0, 0, 0, 0 } };
+
+	if (node->type == LEAF) {
+		if (((leaf_node_t *) node->node)->exp_type == INTEGER) {
+			flat.value = (int) strtol(node->token, NULL, 10);
+		} else {
+			flat.kind = SW_VAR;
+			flat.value = slot_of(node->token);
+		}
+	} else {
+		interior_node_t *interior = (interior_node_t *) node->node;
+		flat.op = interior->op;
+		if (interior->op == ASSIGN_OP) {
+			tree_node_t *target = interior->left;
+			if (target->type != LEAF || ((leaf_node_t *) target->node)->exp_type != SYMBOL) {
+				flat.kind = SW_BAD_ASSIGN;
+			} else {
+				flat.kind = SW_ASSIGN;
+				flat.value = slot_of(target->token);
+				flat.right = flatten(interior->right);
+				sweep.has_assign = 1;
+			}
+		} else if (interior->op == Q_OP) {
+			interior_node_t *alt = (interior_node_t *) interior->right->node;
+			flat.kind = SW_COND;
+			flat.left = flatten(interior->left);
+			flat.right = flatten(alt->left);
+			flat.third = flatten(alt->right);
+		} else {
+			flat.kind = SW_BINARY;
+			flat.left = flatten(interior->left);
+			flat.right = flatten(interior->right);
+		}
+	}
+
+	sweep_node_t *nodes = (sweep_node_t *) realloc(sweep.nodes, (sweep.num_nodes + 1) * sizeof(sweep_node_t));
+	if (nodes == NULL) {
+		fprintf(stderr, "Error: sweep memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	sweep.nodes = nodes;
+	sweep.nodes[sweep.num_nodes] = flat;
+	return sweep.num_nodes++;
+}
+
+/// Works out the magic numbers for every divisor that is the same at
+/// every point: literals, and table symbols that are neither swept nor
+/// assigned
+static void plan_divisions(void) {
+	unsigned char *assigned = (unsigned char *) calloc(sweep.num_slots ? sweep.num_slots : 1, 1);
+	if (assigned == NULL) {
+		fprintf(stderr, "Error: sweep memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < sweep.num_nodes; i++) {
+		if (sweep.nodes[i].kind == SW_ASSIGN) {
+			assigned[sweep.nodes[i].value] = 1;
+		}
+	}
+
+	for (int i = 0; i < sweep.num_nodes; i++) {
+		sweep_node_t *node = &sweep.nodes[i];
+		if (node->kind != SW_BINARY || (node->op != DIV_OP && node->op != MOD_OP)) {
+			continue;
+		}
+		const sweep_node_t *divisor = &sweep.nodes[node->right];
+		int d;
+		if (divisor->kind == SW_CONST) {
+			d = divisor->value;
+		} else if (divisor->kind == SW_VAR && divisor->value >= sweep.num_ranges &&
+			!assigned[divisor->value] && sweep.init_bound[divisor->value]) {
+			d = sweep.init_vals[divisor->value];
+		} else {
+			continue;
+		}
+		if (d < -1 || d > 1) { // 0 and -1 keep their checks
+			fastdiv_init(&node->div, d);
+		}
+	}
+	free(assigned);
+}
+
+/// Evaluates a flattened node the way eval_tree would, but against the
+/// worker's own bindings and without printing anything
+///
+/// @param w The worker
+/// @param index The node to evaluate
+/// @param error Set to the error if one occurs
+/// @return The value (meaningless if *error was set)
+static int eval_point(worker_t *w, int index, eval_error_t *error) {
+	const sweep_node_t *node = &sweep.nodes[index];
+
+	switch (node->kind) {
+		case SW_CONST:
+			return node->value;
+		case SW_VAR:
+			if (!w->bound[node->value]) {
+				*error = UNDEFINED_SYMBOL;
+				return -1;
+			}
+			return w->vals[node->value];
+		case SW_BAD_ASSIGN:
+			*error = INVALID_LVALUE;
+			return -1;
+		case SW_ASSIGN: {
+			int val = eval_point(w, node->right, error);
+			if (*error != EVAL_NONE) {
+				return -1; // Propagate error
+			}
+			w->vals[node->value] = val;
+			w->bound[node->value] = 1;
+			return val;
+		}
+		case SW_COND: {
+			int test_val = eval_point(w, node->left, error);
+			if (*error != EVAL_NONE) {
+				return -1; // Propagate error
+			}
+			return eval_point(w, test_val ? node->right : node->third, error);
+		}
+		case SW_BINARY:
+			break;
+	}
+
+	int left_val = eval_point(w, node->left, error);
+	if (*error != EVAL_NONE) {
+		return -1; // Propagate error
+	}
+	if (node->div.d != 0) { // Its divisor is the same at every point and reading it can't fail
+		return node->op == DIV_OP ? fastdiv_div(&node->div, left_val) : fastdiv_mod(&node->div, left_val);
+	}
+	int right_val = eval_point(w, node->right, error);
+	if (*error != EVAL_NONE) {
+		return -1; // Propagate error
+	}
+
+	switch (node->op) {
+		case ADD_OP: return left_val + right_val;
+		case SUB_OP: return left_val - right_val;
+		case MUL_OP: return left_val * right_val;
+		case DIV_OP:
+		case MOD_OP:
+			if (right_val == 0) {
+				*error = DIVISION_BY_ZERO;
+				return -1;
+			}
+			if (right_val == -1) { // INT_MIN / -1 traps, and one bad point must not kill the sweep
+				return node->op == DIV_OP ? (int) (0U - (unsigned) left_val) : 0;
+			}
+			return node->op == DIV_OP ? left_val / right_val : left_val % right_val;
+		default:
+			*error = UNKNOWN_OPERATION;
+			return -1;
+	}
+}
+
+/// Finds the histogram bucket of a value: 32 holds zero, the buckets above
+/// it hold positive values by bit length and the ones below negative ones
+///
+/// @param val The value
+/// @return The bucket
+static int bucket_of(int val) {
+	if (val == 0) {
+		return HIST_BUCKETS / 2;
+	}
+	unsigned mag = val > 0 ? (unsigned) val : 0U - (unsigned) val;
+	int bits = 32 - __builtin_clz(mag);
+	return val > 0 ? HIST_BUCKETS / 2 + bits : HIST_BUCKETS / 2 - bits;
+}
+
+/// Evaluates points [lo, hi)
+///
+/// @param w The worker
+/// @param lo The first point number
+/// @param hi One past the last point number
+static void run_points(worker_t *w, unsigned long long lo, unsigned long long hi) {
+	stats_t *stats = &w->stats;
+	int odometer[MAX_VARS];
+
+	// Point numbers count through the last variable fastest
+	unsigned long long rest = lo;
+	for (int i = sweep.num_ranges - 1; i >= 0; i--) {
+		odometer[i] = (int) (rest % sweep.ranges[i].size);
+		rest /= sweep.ranges[i].size;
+	}
+
+	for (unsigned long long point = lo; point < hi; point++) {
+		if (sweep.has_assign) {
+			memcpy(w->vals, sweep.init_vals, sweep.num_slots * sizeof(int));
+			memcpy(w->bound, sweep.init_bound, sweep.num_slots);
+		}
+		for (int i = 0; i < sweep.num_ranges; i++) {
+			w->vals[i] = sweep.ranges[i].lo + odometer[i];
+		}
+
+		eval_error_t error = EVAL_NONE;
+		int val = eval_point(w, sweep.root, &error);
+		if (error != EVAL_NONE) {
+			stats->errors[error]++;
+		} else {
+			stats->count++;
+			stats->sum += val;
+			if (val < stats->min) stats->min = val;
+			if (val > stats->max) stats->max = val;
+			stats->hist[bucket_of(val)]++;
+		}
+
+		for (int i = sweep.num_ranges - 1; i >= 0; i--) { // Advance to the next point
+			if ((unsigned long long) ++odometer[i] < sweep.ranges[i].size) {
+				break;
+			}
+			odometer[i] = 0;
+		}
+	}
+}
+
+/// Takes the next chunk of points a worker should run, stealing if it has none
+///
+/// @param w The worker
+/// @param lo Set to the first point number
+/// @param hi Set to one past the last point number
+/// @return 0 when no worker has any points left, non-zero otherwise
+static int take_chunk(worker_t *w, unsigned long long *lo, unsigned long long *hi) {
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		if (w->next < w->end) {
+			*lo = w->next;
+			*hi = w->end - w->next > CHUNK ? w->next + CHUNK : w->end;
+			w->next = *hi;
+			pthread_mutex_unlock(&w->lock);
+			return 1;
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		// Out of work, steal the back half of the first worker that has some
+		int stolen = 0;
+		for (int i = 1; i < sweep.num_workers && !stolen; i++) {
+			worker_t *victim = &sweep.workers[(w->id + i) % sweep.num_workers];
+			pthread_mutex_lock(&victim->lock);
+			unsigned long long left = victim->end - victim->next;
+			if (left > 0) {
+				unsigned long long mid = victim->next + left / 2;
+				unsigned long long end = victim->end;
+				victim->end = mid;
+				pthread_mutex_unlock(&victim->lock);
+
+				pthread_mutex_lock(&w->lock);
+				w->next = mid;
+				w->end = end;
+				pthread_mutex_unlock(&w->lock);
+				stolen = 1;
+			} else {
+				pthread_mutex_unlock(&victim->lock);
+			}
+		}
+		if (!stolen) {
+			return 0; // Ranges only ever shrink, so everything is done
+		}
+	}
+}
+
+/// Worker thread body
+///
+/// @param arg The worker_t
+/// @return NULL
+static void *work(void *arg) {
+	worker_t *w = (worker_t *) arg;
+	unsigned long long lo, hi;
+	while (take_chunk(w, &lo, &hi)) {
+		run_points(w, lo, hi);
+	}
+	return NULL;
+}
+
+/// Prints a possibly 128 bit sum
+///
+/// @param sum The sum
+static void print_sum(sum_t sum) {
+	char digits[48];
+	int at = sizeof(digits) - 1;
+	int negative = sum < 0;
+	digits[at] = '\0';
+	do {
+		int digit = (int) (sum % 10);
+		digits[--at] = (char) ('0' + (digit < 0 ? -digit : digit));
+		sum /= 10;
+	} while (sum != 0);
+	if (negative) {
+		digits[--at] = '-';
+	}
+	printf("%s", digits + at);
+}
+
+/// Prints the combined results
+///
+/// @param total The merged stats
+/// @param points The number of points
+/// @param secs How long the sweep took
+static void report(stats_t *total, unsigned long long points, double secs) {
+	static const char *error_names[NUM_ERRORS] = {
+		NULL, "division by zero", "invalid modulus", "undefined symbol", "unknown operation",
+		"unknown expression type", "missing l-value", "invalid l-value", "symbol table full"
+	};
+
+	unsigned long long errors = 0;
+	for (int i = 0; i < NUM_ERRORS; i++) {
+		errors += total->errors[i];
+	}
+
+	printf("points: %llu (%.0f per second on %d threads)\n", points, points / secs, sweep.num_workers);
+	printf("count: %llu\n", total->count);
+	printf("errors: %llu\n", errors);
+	for (int i = 1; i < NUM_ERRORS; i++) {
+		if (total->errors[i]) {
+			printf("\t%s: %llu\n", error_names[i], total->errors[i]);
+		}
+	}
+	if (total->count == 0) {
+		return;
+	}
+
+	printf("sum: ");
+	print_sum(total->sum);
+	printf("\nmin: %d\nmax: %d\nmean: %.6g\n", total->min, total->max, (double) total->sum / total->count);
+	printf("histogram:\n");
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		if (total->hist[b] == 0) {
+			continue;
+		}
+		int bits = b - HIST_BUCKETS / 2;
+		long long lo, hi;
+		if (bits == 0) {
+			lo = hi = 0;
+		} else if (bits > 0) {
+			lo = 1LL << (bits - 1);
+			hi = (1LL << bits) - 1;
+		} else {
+			lo = bits == -32 ? INT_MIN : -((1LL << -bits) - 1);
+			hi = -(1LL << (-bits - 1));
+		}
+		printf("\t[%lld, %lld]: %llu\n", lo, hi, total->hist[b]);
+	}
+}
+
+/// Evaluates the tree at every point of the ranges and prints the aggregates
+///
+/// @param spec The ranges
+/// @param root The parsed expression
+/// @param threads The number of worker threads (0 for one per core)
+void run_sweep(char *spec, tree_node_t *root, int threads) {
+	parse_spec(spec);
+
+	// The swept variables take the first slots, so they shadow the table
+	unsigned long long points = 1;
+	for (int i = 0; i < sweep.num_ranges; i++) {
+		slot_of(sweep.ranges[i].name);
+		sweep.init_bound[i] = 1;
+		if (points > ULLONG_MAX / sweep.ranges[i].size) {
+			bad_spec("too many points");
+		}
+		points *= sweep.ranges[i].size;
+	}
+	sweep.root = flatten(root);
+	plan_divisions();
+
+	sweep.num_workers = threads > 0 ? threads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (sweep.num_workers < 1) {
+		sweep.num_workers = 1;
+	}
+	sweep.workers = (worker_t *) calloc(sweep.num_workers, sizeof(worker_t));
+	if (sweep.workers == NULL) {
+		fprintf(stderr, "Error: sweep memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Start with an even split, stealing evens out whatever is left
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < sweep.num_workers; i++) {
+		worker_t *w = &sweep.workers[i];
+		pthread_mutex_init(&w->lock, NULL);
+		w->id = i;
+		w->next = points / sweep.num_workers * i;
+		w->end = i == sweep.num_workers - 1 ? points : points / sweep.num_workers * (i + 1);
+		w->vals = (int *) malloc(sweep.num_slots * sizeof(int));
+		w->bound = (unsigned char *) malloc(sweep.num_slots);
+		if (w->vals == NULL || w->bound == NULL) {
+			fprintf(stderr, "Error: sweep memory allocation failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(w->vals, sweep.init_vals, sweep.num_slots * sizeof(int));
+		memcpy(w->bound, sweep.init_bound, sweep.num_slots);
+		w->stats.min = INT_MAX;
+		w->stats.max = INT_MIN;
+	}
+	for (int i = 0; i < sweep.num_workers; i++) {
+		if (pthread_create(&sweep.workers[i].thread, NULL, work, &sweep.workers[i]) != 0) {
+			fprintf(stderr, "Error: could not create sweep thread.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	stats_t total;
+	memset(&total, 0, sizeof(total));
+	total.min = INT_MAX;
+	total.max = INT_MIN;
+	for (int i = 0; i < sweep.num_workers; i++) {
+		worker_t *w = &sweep.workers[i];
+		pthread_join(w->thread, NULL);
+		total.count += w->stats.count;
+		total.sum += w->stats.sum;
+		if (w->stats.min < total.min) total.min = w->stats.min;
+		if (w->stats.max > total.max) total.max = w->stats.max;
+		for (int e = 0; e < NUM_ERRORS; e++) {
+			total.errors[e] += w->stats.errors[e];
+		}
+		for (int b = 0; b < HIST_BUCKETS; b++) {
+			total.hist[b] += w->stats.hist[b];
+		}
+		pthread_mutex_destroy(&w->lock);
+		free(w->vals);
+		free(w->bound);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	report(&total, points, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	free(sweep.workers);
+	free(sweep.nodes);
+	free(sweep.slot_names);
+	free(sweep.init_vals);
+	free(sweep.init_bound);
+}
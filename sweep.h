@@ -0,0 +1,27 @@
+/// Parameter sweeps: evaluating one expression over every point of a
+/// cartesian range of variable values, in parallel, and reporting
+/// aggregates instead of one line per point.
+///
+/// Each point starts from the same bindings: the swept variables hold
+/// the values for that point and every other symbol holds the value it
+/// had in the symbol table when the sweep started.  Assignments made by
+/// the expression only last for the point that made them, so points
+/// are independent and can run in any order.
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "tree_node.h"
+
+/// Evaluates the tree at every point of the ranges and prints the
+/// count, sum, min, max, a log2 histogram of the values and the
+/// number of points that failed with each kind of error.  Memory use
+/// does not depend on the number of points.
+/// @param spec  the ranges, e.g. "x=0..1e9,y=1..100" (inclusive)
+/// @param root  the parsed expression
+/// @param threads  the number of worker threads (0 for one per core)
+/// @exception If the ranges are malformed, an error message is
+///     displayed and the program exits with EXIT_FAILURE.
+void run_sweep(char *spec, tree_node_t *root, int threads);
+
+#endif
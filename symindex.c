@@ -0,0 +1,319 @@
+/*
+ * symindex.c
+ *
+ * The ordered name index, a skip list. Nodes are linked into the
+ * bottom level with a release CAS, which is when the name becomes part
+ * of the index, and then into the levels above it one at a time.
+ * Readers only ever follow links, so a node that is only partly linked
+ * is just a node that searches find a little later.
+ *
+ * Inserting names one at a time in the order a table file lists them
+ * costs a cache miss or two per level, which would make loading a big
+ * table several times slower. So the index is only built when it is
+ * first needed, from a sorted copy of the list, and kept up to date
+ * from then on.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "symindex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One name
+typedef struct index_node_s {
+	symbol_t *symbol;       // the binding lookups see, only accessed atomically
+	char *name;             // the name of the first binding, which outlives the rest
+	int height;             // the number of levels it is linked into
+	struct index_node_s *next[]; // the next node at each level
+} index_node_t;
+
+// The first node at each level
+static index_node_t *roots[INDEX_MAX_LEVEL];
+static int built = 0; // Whether the index has been built, and so must be kept up to date
+
+// A symbol in the order index_build sorts them
+typedef struct index_entry_s {
+	symbol_t *symbol;
+	size_t age;             // the position in the list, oldest first
+} index_entry_t;
+
+/// Returns the links out of a node
+///
+/// @param node The node, or NULL for the roots
+/// @return Its next array
+static index_node_t **links(index_node_t *node) {
+	return node == NULL ? roots : node->next;
+}
+
+/// Picks how many levels a name is linked into: one more for each pair
+/// of trailing zero bits of its hash, so each level has a quarter of
+/// the names of the one below it.  Hashing the name rather than drawing
+/// a random number needs no state shared between threads.
+///
+/// @param name The name
+/// @return The height, from 1 to INDEX_MAX_LEVEL
+static int height_of(char *name) {
+	unsigned hash = 2166136261u; // 32 bit FNV-1a
+	for (unsigned char *c = (unsigned char *) name; *c != '\0'; c++) {
+		hash = (hash ^ *c) * 16777619u;
+	}
+	hash ^= hash >> 16; // The low bits of FNV are the weakest
+	int height = 1;
+	while (height < INDEX_MAX_LEVEL && (hash & 3) == 0) {
+		height++;
+		hash = hash >> 2 | 1u << 31; // Runs out of zeros after 15 pairs
+	}
+	return height;
+}
+
+/// Allocates a node that is not linked in yet
+///
+/// @param symbol The first binding of its name
+/// @param height The number of levels it will be linked into
+/// @return The node
+static index_node_t *new_node(symbol_t *symbol, int height) {
+	index_node_t *node = (index_node_t *) malloc(sizeof(index_node_t) + height * sizeof(index_node_t *));
+	if (node == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: symbol index memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	node->symbol = symbol;
+	node->name = symbol->var_name;
+	node->height = height;
+	symbol->outer = NULL;
+	return node;
+}
+
+/// Finds where a name is, or would go, at every level
+///
+/// @param name The name
+/// @param preds Set to the last node before the name at each level (NULL for the roots)
+/// @param succs Set to the first node at or after the name at each level
+/// @return The node for the name, or NULL if it is not in the index
+static index_node_t *find(char *name, index_node_t **preds, index_node_t **succs) {
+	index_node_t *pred = NULL;
+	for (int level = INDEX_MAX_LEVEL - 1; level >= 0; level--) {
+		index_node_t *current = __atomic_load_n(&links(pred)[level], __ATOMIC_ACQUIRE);
+		while (current != NULL && strcmp(current->name, name) < 0) {
+			pred = current;
+			current = __atomic_load_n(&current->next[level], __ATOMIC_ACQUIRE);
+		}
+		preds[level] = pred;
+		succs[level] = current;
+	}
+	return succs[0] != NULL && strcmp(succs[0]->name, name) == 0 ? succs[0] : NULL;
+}
+
+/// Adds a symbol to the index
+///
+/// @param symbol The newly published symbol
+void index_add(symbol_t *symbol) {
+	if (!__atomic_load_n(&built, __ATOMIC_ACQUIRE)) {
+		return; // index_build will find it in the list
+	}
+	index_node_t *preds[INDEX_MAX_LEVEL];
+	index_node_t *succs[INDEX_MAX_LEVEL];
+	index_node_t *node = NULL;
+	int height = height_of(symbol->var_name);
+
+	for (;;) {
+		index_node_t *found = find(symbol->var_name, preds, succs);
+		if (found != NULL) {
+			// Only a scope can bind a name twice, and scopes belong to one thread
+			symbol->outer = __atomic_load_n(&found->symbol, __ATOMIC_ACQUIRE);
+			__atomic_store_n(&found->symbol, symbol, __ATOMIC_RELEASE);
+			free(node);
+			return;
+		}
+
+		if (node == NULL) {
+			node = new_node(symbol, height);
+		}
+		for (int level = 0; level < height; level++) {
+			node->next[level] = succs[level];
+		}
+
+		// Release makes the node visible only after everything in it is
+		index_node_t *expected = succs[0];
+		if (__atomic_compare_exchange_n(&links(preds[0])[0], &expected, node, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+
+	// Searches already find the node, the upper levels only make them faster
+	for (int level = 1; level < height; level++) {
+		for (;;) {
+			index_node_t *expected = succs[level];
+			if (__atomic_compare_exchange_n(&links(preds[level])[level], &expected, node, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+				break;
+			}
+			find(symbol->var_name, preds, succs); // Someone linked a node in next to ours first
+			__atomic_store_n(&node->next[level], succs[level], __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/// Adds a base table symbol beneath any bindings that shadow it
+///
+/// @param symbol The symbol
+void index_add_outer(symbol_t *symbol) {
+	if (!built) {
+		return;
+	}
+	index_node_t *preds[INDEX_MAX_LEVEL];
+	index_node_t *succs[INDEX_MAX_LEVEL];
+	index_node_t *found = find(symbol->var_name, preds, succs);
+	if (found == NULL) {
+		index_add(symbol);
+		return;
+	}
+
+	symbol_t *last = found->symbol;
+	for (;;) {
+		if (last == symbol) {
+			return; // Listed before
+		}
+		if (last->outer == NULL) {
+			break;
+		}
+		last = last->outer;
+	}
+	symbol->outer = NULL;
+	last->outer = symbol;
+}
+
+/// Removes a symbol from the index
+///
+/// @param symbol The symbol about to be freed
+void index_remove(symbol_t *symbol) {
+	if (!built) {
+		return;
+	}
+	index_node_t *preds[INDEX_MAX_LEVEL];
+	index_node_t *succs[INDEX_MAX_LEVEL];
+	index_node_t *node = find(symbol->var_name, preds, succs);
+	if (node == NULL) {
+		return;
+	}
+
+	if (symbol->outer != NULL) {
+		__atomic_store_n(&node->symbol, symbol->outer, __ATOMIC_RELEASE); // Visible again
+		return;
+	}
+	for (int level = 0; level < node->height; level++) {
+		if (succs[level] == node) {
+			__atomic_store_n(&links(preds[level])[level], node->next[level], __ATOMIC_RELEASE);
+		}
+	}
+	free(node);
+}
+
+/// Orders symbols by name, and bindings of the same name oldest first
+///
+/// @param a The first index_entry_t
+/// @param b The second index_entry_t
+/// @return Their order, as strcmp
+static int compare_entries(const void *a, const void *b) {
+	const index_entry_t *first = (const index_entry_t *) a;
+	const index_entry_t *second = (const index_entry_t *) b;
+	int order = strcmp(first->symbol->var_name, second->symbol->var_name);
+	if (order != 0) {
+		return order;
+	}
+	return (first->age > second->age) - (first->age < second->age);
+}
+
+/// Builds the index from the list, if it has not been built yet
+///
+/// @param newest The head of the list
+void index_build(symbol_t *newest) {
+	if (built) {
+		return;
+	}
+
+	size_t count = 0;
+	for (symbol_t *symbol = newest; symbol != NULL; symbol = symbol->next) {
+		count++;
+	}
+	index_entry_t *entries = (index_entry_t *) malloc((count ? count : 1) * sizeof(index_entry_t));
+	if (entries == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: symbol index memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t age = count;
+	for (symbol_t *symbol = newest; symbol != NULL; symbol = symbol->next) {
+		age--;
+		entries[age].symbol = symbol;
+		entries[age].age = age;
+	}
+	qsort(entries, count, sizeof(index_entry_t), compare_entries);
+
+	// Sorted, so every node goes at the end of each level it is in
+	index_node_t *last[INDEX_MAX_LEVEL] = { NULL };
+	index_node_t *node = NULL;
+	for (size_t i = 0; i < count; i++) {
+		symbol_t *symbol = entries[i].symbol;
+		if (node != NULL && strcmp(node->name, symbol->var_name) == 0) {
+			symbol->outer = node->symbol; // A scope shadows it
+			node->symbol = symbol;
+			continue;
+		}
+
+		node = new_node(symbol, height_of(symbol->var_name));
+		for (int level = 0; level < node->height; level++) {
+			node->next[level] = NULL;
+			links(last[level])[level] = node;
+			last[level] = node;
+		}
+	}
+	free(entries);
+	__atomic_store_n(&built, 1, __ATOMIC_RELEASE);
+}
+
+/// Visits names in sorted order
+///
+/// @param prefix Only names starting with this
+/// @param after Only names after this one, or NULL
+/// @param visit Called for each name
+/// @param arg Passed to visit
+void index_walk(char *prefix, char *after, index_visit_t visit, void *arg) {
+	size_t prefix_len = strlen(prefix);
+	int skip = after != NULL && strcmp(after, prefix) >= 0; // Start past after rather than at prefix
+	char *from = skip ? after : prefix;
+
+	// The same descent as find, but nothing needs to be remembered
+	index_node_t *pred = NULL;
+	index_node_t *current = NULL;
+	for (int level = INDEX_MAX_LEVEL - 1; level >= 0; level--) {
+		current = __atomic_load_n(&links(pred)[level], __ATOMIC_ACQUIRE);
+		while (current != NULL && strcmp(current->name, from) < 0) {
+			pred = current;
+			current = __atomic_load_n(&current->next[level], __ATOMIC_ACQUIRE);
+		}
+	}
+	if (skip && current != NULL && strcmp(current->name, from) == 0) {
+		current = __atomic_load_n(&current->next[0], __ATOMIC_ACQUIRE);
+	}
+
+	while (current != NULL) {
+		symbol_t *symbol = __atomic_load_n(&current->symbol, __ATOMIC_ACQUIRE);
+		if (strncmp(symbol->var_name, prefix, prefix_len) != 0 || !visit(symbol, arg)) {
+			return; // Past the last name with the prefix
+		}
+		current = __atomic_load_n(&current->next[0], __ATOMIC_ACQUIRE);
+	}
+}
+
+/// Empties the index
+void index_free(void) {
+	index_node_t *current = roots[0];
+	while (current != NULL) {
+		index_node_t *next = current->next[0];
+		free(current);
+		current = next;
+	}
+	memset(roots, 0, sizeof(roots));
+	built = 0;
+}
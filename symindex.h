@@ -0,0 +1,67 @@
+/// An ordered index of the names in the symbol table
+///
+/// The symbol list keeps names in the order they were added, so any
+/// sorted or prefix query over it would have to read all of it.  The
+/// index is a skip list with one node per name, ordered by strcmp,
+/// kept up to date by the symbol table itself.  Each node points at
+/// the binding of its name that lookups see, so scopes that shadow a
+/// name move the node to the new binding and back again when they end.
+///
+/// The index is built from the list the first time it is needed, so
+/// runs that never ask for sorted output never pay for it.  From then
+/// on, like the list, it may be added to by several threads at once and
+/// read without locks; nodes are only removed when scopes are popped or
+/// committed, which no other thread may do at the same time.
+
+#ifndef SYMINDEX_H
+#define SYMINDEX_H
+
+#include "symtab.h"
+
+#define INDEX_MAX_LEVEL 24      // enough for 4^24 names before it slows down
+
+/// Called for each name a walk visits
+/// @param symbol  the binding of the name that lookups see
+/// @param arg  what was passed to index_walk
+/// @return non-zero to go on, 0 to stop the walk
+typedef int (*index_visit_t)(symbol_t *symbol, void *arg);
+
+/// Builds the index from the symbol list, unless it is built already.
+/// Takes time proportional to n log n for n symbols.  No other thread
+/// may be using the table.
+/// @param newest  the newest symbol of the list
+void index_build(symbol_t *newest);
+
+/// Adds a newly published symbol to the index, if it is built.  If its
+/// name is already there, the symbol shadows the old binding, which is
+/// kept in its outer field.
+/// @param symbol  the symbol
+void index_add(symbol_t *symbol);
+
+/// Adds a base table symbol found after the index was built, if it is
+/// built.  If its name is already there, the symbol goes beneath the
+/// bindings of the scopes that shadow it, unless it is among them
+/// already.  Only one thread may add base table symbols this way.
+/// @param symbol  the symbol
+void index_add_outer(symbol_t *symbol);
+
+/// Removes a symbol that is about to be freed, if the index is built.
+/// Its name goes back to the binding it shadowed, or out of the index
+/// if there was none.  No other thread may be using the table.
+/// @param symbol  the symbol, which must be its name's binding
+void index_remove(symbol_t *symbol);
+
+/// Visits names in sorted order, starting at the first name that has
+/// the prefix and comes after after, until a name without the prefix
+/// is reached.  Takes time proportional to the log of the number of
+/// names plus the number visited.  The index must have been built.
+/// @param prefix  only names starting with this ("" for all)
+/// @param after  only names that sort after this one, or NULL
+/// @param visit  called for each name
+/// @param arg  passed to visit
+void index_walk(char *prefix, char *after, index_visit_t visit, void *arg);
+
+/// Empties the index (no other thread may be using the table)
+void index_free(void);
+
+#endif
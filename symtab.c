@@ -2,12 +2,45 @@
 
 #define _DEFAULT_SOURCE // This caused a headache. VERY IMPORTANT
 #include "symtab.h"
+#include "shmtab.h"
+#include "lazytab.h"
+#include "symindex.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
+// Readers walk the list without locks; writers publish new nodes at the head
+// with a release CAS. Nodes are never unlinked while the table is live, so a
+// reader can never touch freed memory and reclamation waits for free_table.
 static symbol_t *head = NULL;
+static symtab_hook_t hook = NULL; // Told about every change, for logging
+
+// Once a sorted dump has built the ordered index (symindex.h), every name
+// in the list is also in it; it is told about each node published and
+// each node freed
+
+// Scopes are overlays on the same list: everything bound inside a scope is
+// a node added above the head the list had when the scope was pushed, so
+// lookups find it before anything it shadows and popping is just cutting
+// the list back to that mark.
+static symbol_t **marks = NULL; // head of the list when each open scope was pushed
+static int depth = 0;           // the number of open scopes
+static int marks_cap = 0;       // the allocated number of marks
+
+// Nodes a pop or commit took out of the list. A reader may still be on
+// one, so like every other node they are only freed by free_table.
+static symbol_t **retired = NULL;
+static size_t retired_count = 0;
+static size_t retired_cap = 0;
+
+// With a shared table (--shm) the base table lives there and the list only
+// holds the bindings of open scopes
+static shmtab_t *shared = NULL;
+
+// With a lazily loaded table (--lazy) the same goes for the file's symbols
+// and the ones added since
+static lazytab_t *lazy = NULL;
 
 /// Builds the symbol table from the given file
 ///
@@ -56,35 +89,110 @@ void build_table(char *filename) { // Per assignment, variable names are unique.
 /// Dumps the contents of the symbol table
 void dump_table(void) { // Print the contents of the symbol table
 	printf("\nSYMBOL TABLE:\n");
-	symbol_t *current = head;
+	if (shared != NULL) {
+		shmtab_dump(shared);
+		return;
+	}
+	if (lazy != NULL) {
+		lazytab_dump(lazy);
+		return;
+	}
+	symbol_t *current = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
 	while (current != NULL) {
-		printf("\tName: %s, Value: %d\n", current->var_name, current->val);
+		printf("\tName: %s, Value: %d\n", current->var_name, get_symbol_val(current));
 		current = current->next;
 	}
 }
 
-/// Looks up a symbol in the table
+// How far a sorted dump has got
+typedef struct dump_state_s {
+	char *prefix;           // the prefix, or the whole name if exact
+	int exact;              // only the name itself
+	unsigned long limit;    // the most to print, 0 for all
+	unsigned long printed;  // how many have been printed
+	char *last;             // the name printed last
+} dump_state_t;
+
+/// Prints one symbol of a sorted dump
+///
+/// @param symbol The symbol
+/// @param arg The dump_state_t
+/// @return 0 once the dump is done, non-zero otherwise
+static int dump_one(symbol_t *symbol, void *arg) {
+	dump_state_t *state = (dump_state_t *) arg;
+	if (state->exact && strcmp(symbol->var_name, state->prefix) != 0) {
+		return 0; // Longer names with the same start come after it
+	}
+	if (state->limit != 0 && state->printed == state->limit) {
+		printf("\t... more after %s\n", state->last); // Where the next page starts
+		return 0;
+	}
+	printf("\tName: %s, Value: %d\n", symbol->var_name, get_symbol_val(symbol));
+	state->printed++;
+	state->last = symbol->var_name;
+	return 1;
+}
+
+/// Dumps the matching symbols in sorted order
+///
+/// @param prefix Only names starting with this
+/// @param exact Only the name prefix itself
+/// @param after Only names after this one, or NULL
+/// @param limit The most to print, 0 for all
+void dump_sorted(char *prefix, int exact, char *after, unsigned long limit) {
+	dump_state_t state = { prefix, exact, limit, 0, NULL };
+	index_build(head); // Only the first time
+	if (shared != NULL || lazy != NULL) {
+		// Catch up on the base table symbols made since the last dump
+		size_t count;
+		symbol_t **symbols = shared != NULL ? shmtab_new_symbols(shared, &count) : lazytab_new_symbols(lazy, &count);
+		for (size_t i = 0; i < count; i++) {
+			index_add_outer(symbols[i]);
+		}
+		free(symbols);
+	}
+	printf("SYMBOL TABLE:\n");
+	index_walk(prefix, after, dump_one, &state);
+}
+
+/// Searches the list from first up to (not including) last
 ///
+/// @param first The node to start searching at
+/// @param last The node to stop at, or NULL for the end of the list
 /// @param variable The name of the variable to look up
 /// @return The symbol if found, NULL otherwise
-symbol_t  *lookup_table(char * variable) {
-	symbol_t *current = head;
-	while (current != NULL) {
+static symbol_t *lookup_range(symbol_t *first, symbol_t *last, char *variable) {
+	// next is only written before a node is published, so plain loads are fine here
+	for (symbol_t *current = first; current != last; current = current->next) {
 		if (strcmp(current->var_name, variable) == 0) { // Then we found the variable with the name we wanted, so return the symbol object
 			return current;
 		}
-		current = current->next;
 	}
 
 	return NULL; // We did not find the variable with the name, so return NULL per assignment
 }
 
-/// Creates a new symbol and adds it to the table
+/// Looks up a symbol in the table
+///
+/// @param variable The name of the variable to look up
+/// @return The symbol if found, NULL otherwise
+symbol_t  *lookup_table(char * variable) {
+	symbol_t *symbol = lookup_range(__atomic_load_n(&head, __ATOMIC_ACQUIRE), NULL, variable);
+	if (symbol == NULL && shared != NULL) {
+		return shmtab_lookup(shared, variable); // Not shadowed by a scope
+	}
+	if (symbol == NULL && lazy != NULL) {
+		return lazytab_lookup(lazy, variable);
+	}
+	return symbol;
+}
+
+/// Allocates a symbol that has not been published yet
 ///
 /// @param name The name of the symbol
 /// @param val The value of the symbol
-/// @return The newly created symbol
-symbol_t *create_symbol(char *name, int val) {
+/// @return The new, unlinked symbol
+static symbol_t *alloc_symbol(char *name, int val) {
 	symbol_t *new_symbol = (symbol_t *) malloc(sizeof(symbol_t));
 	if (new_symbol == NULL) { // Check if malloc failed
 		fprintf(stderr,"Error: symbol memory allocation failed.\n");
@@ -99,13 +207,258 @@ symbol_t *create_symbol(char *name, int val) {
 	}
 
 	new_symbol->val = val;
-	new_symbol->next = head;
-	head = new_symbol;
+	new_symbol->depth = depth;
+	new_symbol->shared = NULL;
+	new_symbol->outer = NULL;
+	new_symbol->next = NULL;
+
+	return new_symbol;
+}
+
+/// Creates a new symbol and adds it to the table
+///
+/// @param name The name of the symbol
+/// @param val The value of the symbol
+/// @return The newly created symbol
+symbol_t *create_symbol(char *name, int val) {
+	if (shared != NULL && depth == 0) {
+		return shmtab_bind(shared, name, val);
+	}
+	if (lazy != NULL && depth == 0) {
+		return lazytab_bind(lazy, name, val);
+	}
+	symbol_t *new_symbol = alloc_symbol(name, val);
 
+	// Release makes the name and value visible before the node is reachable
+	symbol_t *old_head = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	do {
+		new_symbol->next = old_head;
+	} while (!__atomic_compare_exchange_n(&head, &old_head, new_symbol, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	index_add(new_symbol);
+
+	if (hook != NULL && new_symbol->depth == 0) {
+		hook(new_symbol);
+	}
 	return new_symbol;
 }
 
+/// Binds a value to a name, creating the symbol if it does not exist
+///
+/// @param name The name of the symbol
+/// @param val The value to bind
+/// @return The symbol that now holds the value
+symbol_t *bind_symbol(char *name, int val) {
+	if (shared != NULL && depth == 0) {
+		return shmtab_bind(shared, name, val);
+	}
+	if (lazy != NULL && depth == 0) {
+		return lazytab_bind(lazy, name, val);
+	}
+
+	symbol_t *seen = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	symbol_t *symbol = lookup_range(seen, NULL, name);
+	if (symbol != NULL && symbol->depth == depth) {
+		set_symbol_val(symbol, val);
+		return symbol;
+	}
+	if (symbol != NULL) {
+		return create_symbol(name, val); // Shadow it, scopes are only ever changed by one thread
+	}
+
+	symbol_t *new_symbol = alloc_symbol(name, val);
+	symbol_t *old_head = seen;
+	for (;;) {
+		new_symbol->next = old_head;
+		if (__atomic_compare_exchange_n(&head, &old_head, new_symbol, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+			index_add(new_symbol);
+			if (hook != NULL && new_symbol->depth == 0) {
+				hook(new_symbol);
+			}
+			return new_symbol;
+		}
+
+		// Someone else published first, only the nodes they added can hold our name
+		symbol = lookup_range(old_head, seen, name);
+		if (symbol != NULL) {
+			free(new_symbol->var_name);
+			free(new_symbol);
+			set_symbol_val(symbol, val);
+			return symbol;
+		}
+		seen = old_head;
+	}
+}
+
+/// Reads the value bound to a symbol
+///
+/// @param symbol The symbol to read
+/// @return The current value
+int get_symbol_val(symbol_t *symbol) {
+	return __atomic_load_n(symbol->shared ? symbol->shared : &symbol->val, __ATOMIC_ACQUIRE);
+}
+
+/// Updates the value bound to a symbol in place
+///
+/// @param symbol The symbol to update
+/// @param val The new value
+void set_symbol_val(symbol_t *symbol, int val) {
+	__atomic_store_n(symbol->shared ? symbol->shared : &symbol->val, val, __ATOMIC_RELEASE);
+	if (hook != NULL && symbol->depth == 0) {
+		hook(symbol);
+	}
+}
+
+/// Installs the function told about every change to the table
+///
+/// @param new_hook The function, or NULL for none
+void set_symtab_hook(symtab_hook_t new_hook) {
+	hook = new_hook;
+}
+
+/// Switches to a shared memory table
+///
+/// @param shm The mapped table
+void use_shared_table(shmtab_t *shm) {
+	shared = shm;
+}
+
+/// Switches to a lazily loaded table
+///
+/// @param table The table
+void use_lazy_table(lazytab_t *table) {
+	lazy = table;
+}
+
+/// Returns the most recently added symbol
+///
+/// @return The head of the list, or NULL if the table is empty
+symbol_t *newest_symbol(void) {
+	return __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
+
+/// Opens a scope
+void push_scope(void) {
+	if (depth == marks_cap) {
+		int cap = marks_cap ? marks_cap * 2 : 8;
+		symbol_t **new_marks = (symbol_t **) realloc(marks, cap * sizeof(symbol_t *));
+		if (new_marks == NULL) { // Check if realloc failed
+			fprintf(stderr, "Error: scope memory allocation failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		marks = new_marks;
+		marks_cap = cap;
+	}
+	marks[depth++] = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
+
+/// Takes a node that is no longer reachable from the head out of the
+/// index, and keeps it for free_table to free
+///
+/// @param symbol The node
+static void retire(symbol_t *symbol) {
+	if (retired_count == retired_cap) {
+		size_t cap = retired_cap ? retired_cap * 2 : 64;
+		symbol_t **bigger = (symbol_t **) realloc(retired, cap * sizeof(symbol_t *));
+		if (bigger == NULL) { // Check if realloc failed
+			fprintf(stderr, "Error: scope memory allocation failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		retired = bigger;
+		retired_cap = cap;
+	}
+	index_remove(symbol);
+	retired[retired_count++] = symbol;
+}
+
+/// Discards the innermost scope
+///
+/// @return 1 if a scope was popped, 0 if none is open
+int pop_scope(void) {
+	if (depth == 0) {
+		return 0;
+	}
+
+	symbol_t *mark = marks[--depth];
+	symbol_t *current = head;
+	__atomic_store_n(&head, mark, __ATOMIC_RELEASE);
+	while (current != mark) { // Only what the scope bound is above the mark
+		retire(current);
+		current = current->next;
+	}
+	return 1;
+}
+
+/// Folds the innermost scope into its parent. The scope's nodes are left
+/// as they are, for readers that may be on them; the bindings that stay
+/// in the list are new copies, published with the new head all at once.
+///
+/// @return 1 if a scope was committed, 0 if none is open
+int commit_scope(void) {
+	if (depth == 0) {
+		return 0;
+	}
+
+	symbol_t *mark = marks[--depth];
+	size_t count = 0;
+	for (symbol_t *current = head; current != mark; current = current->next) {
+		count++;
+	}
+	symbol_t **scope = (symbol_t **) malloc((count ? count : 1) * sizeof(symbol_t *));
+	if (scope == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: scope memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t i = count;
+	for (symbol_t *current = head; current != mark; current = current->next) {
+		scope[--i] = current; // Oldest first
+	}
+
+	// Each binding goes where the enclosing scope keeps it; scope[i] becomes its new node, if any
+	symbol_t *new_head = mark;
+	for (i = 0; i < count; i++) {
+		symbol_t *kept = scope[i];
+		symbol_t *outer = lookup_range(mark, NULL, kept->var_name);
+		scope[i] = NULL;
+		if (shared != NULL && depth == 0) {
+			if (shmtab_bind(shared, kept->var_name, kept->val) == NULL) {
+				fprintf(stderr, "Error: Symbol table full.\n"); // This one binding is lost
+			}
+		} else if (lazy != NULL && depth == 0) {
+			lazytab_bind(lazy, kept->var_name, kept->val);
+		} else if (outer != NULL && outer->depth == depth) {
+			set_symbol_val(outer, kept->val); // The parent already has its own copy
+		} else {
+			symbol_t *copy = alloc_symbol(kept->var_name, kept->val); // Still shadows anything further out
+			copy->next = new_head;
+			new_head = copy;
+			scope[i] = copy;
+		}
+		retire(kept);
+	}
+	__atomic_store_n(&head, new_head, __ATOMIC_RELEASE);
+
+	// Oldest first, so the hook sees new names in the order they were made
+	for (i = 0; i < count; i++) {
+		if (scope[i] != NULL) {
+			index_add(scope[i]);
+			if (hook != NULL && depth == 0) {
+				hook(scope[i]);
+			}
+		}
+	}
+	free(scope);
+	return 1;
+}
+
+/// Returns how many scopes are open
+///
+/// @return The depth of the innermost scope
+int get_scope_depth(void) {
+	return depth;
+}
+
 /// Frees the memory allocated for the symbol table
+/// (no other thread may be using the table)
 void free_table(void) {
 	symbol_t *current = head;
 	while (current != NULL) { // Iterate through the table
@@ -117,4 +470,23 @@ void free_table(void) {
 
 	//current = NULL;
 	head = NULL;
+	for (size_t i = 0; i < retired_count; i++) {
+		free(retired[i]->var_name);
+		free(retired[i]);
+	}
+	free(retired);
+	retired = NULL;
+	retired_count = retired_cap = 0;
+	index_free();
+	if (shared != NULL) {
+		shmtab_close(shared);
+		shared = NULL;
+	}
+	if (lazy != NULL) {
+		lazytab_close(lazy);
+		lazy = NULL;
+	}
+	free(marks);
+	marks = NULL;
+	depth = marks_cap = 0;
 }
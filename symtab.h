@@ -6,12 +6,29 @@
 #define BUFLEN 1024             // input buffer length for initial symbols
 
 // A single symbol definition
+//
+// The table may be shared by several threads.  Lookups never lock,
+// val must only be accessed through get_symbol_val/set_symbol_val, and
+// next never changes once a symbol has been added to the table.  A
+// symbol stays allocated until free_table, even after the scope that
+// added it is popped or committed, so a reader can never be left on a
+// freed one.
 typedef struct symbol_s {
     char *var_name;             // the name of the symbol
     int val;                    // the value currently bound to this symbol
+    int depth;                  // the scope that wrote it, 0 for the base table
+    int *shared;                // where val really is (shared tables), or NULL
+    struct symbol_s *outer;     // the binding it shadows (see symindex.h), or NULL
     struct symbol_s *next;      // the next item in the list
 } symbol_t;
 
+// The scope commands (see push_scope)
+typedef enum scope_op_e {
+    SCOPE_PUSH,                 // open a scope
+    SCOPE_POP,                  // discard the innermost scope
+    SCOPE_COMMIT                // fold the innermost scope into its parent
+} scope_op_t;
+
 /// Constructs the table by reading the file.  The format is
 /// one symbol per line in the format:
 ///
@@ -41,6 +58,21 @@ void build_table(char *filename);
 /// Each symbol should be printed one per line, tab-indented.
 void dump_table(void);
 
+/// Displays the symbols whose names match, sorted by name, in the
+/// format dump_table uses.  The first call sorts the whole table to
+/// build an index (see symindex.h), and no other thread may be using
+/// the table then.  After that, it takes time proportional to the
+/// number printed plus the log of the size of the table.  With a shared
+/// or lazily loaded table, each call also adds the symbols made since
+/// the one before, and the first adds them all, reading the whole file
+/// when it is lazily loaded.
+/// @param prefix  only names starting with this ("" for all)
+/// @param exact  non-zero to only show the name prefix itself
+/// @param after  only names that sort after this one, or NULL
+/// @param limit  print at most this many, 0 for no limit; if more
+///     match, a last line says which name to continue after
+void dump_sorted(char *prefix, int exact, char *after, unsigned long limit);
+
 /// Returns the symtab_t object in the symbol table associated
 ///     with the variable name
 /// @param variable The name of the variable (a C string)
@@ -56,7 +88,85 @@ symbol_t *lookup_table(char *variable);
 /// No check is done to see if the symbol is already in the table
 symbol_t *create_symbol(char *name, int val);
 
-/// Destroys the symbol table
+/// Binds a value to a variable, creating the symbol if it is not
+/// already in the table.  Unlike a lookup_table/create_symbol pair this
+/// is safe when several threads bind the same new name at once.
+/// Inside a scope, a symbol from an outer scope is not changed: a copy
+/// bound to the new value shadows it until the scope ends.
+/// @param name  The name of the variable (a C string)
+/// @param val  The value to bind
+/// @return the symbol_t object holding the binding, or NULL if a
+///     shared table is full
+symbol_t *bind_symbol(char *name, int val);
+
+/// Atomically reads the value bound to a symbol
+/// @param symbol  The symbol to read
+/// @return the current value
+int get_symbol_val(symbol_t *symbol);
+
+/// Atomically replaces the value bound to a symbol, in place whatever
+/// scope it belongs to
+/// @param symbol  The symbol to update
+/// @param val  The new value
+void set_symbol_val(symbol_t *symbol, int val);
+
+/// Called after a symbol is created or its value changes
+typedef void (*symtab_hook_t)(symbol_t *symbol);
+
+/// Installs a function to be told about every change to the table
+/// (used to log changes, see wal.h).  Writers call it themselves, after
+/// the change is visible.  Changes made inside a scope are only told
+/// when they are committed to the base table.
+/// @param hook  the function, or NULL for none
+void set_symtab_hook(symtab_hook_t hook);
+
+struct shmtab_s;                // a table in shared memory (see shmtab.h)
+
+/// Switches to a shared memory table (see attach_shared_table in
+/// shmtab.h).  Only bindings made inside scopes stay private.
+/// @param shm  the mapped table
+void use_shared_table(struct shmtab_s *shm);
+
+struct lazytab_s;               // a table loaded on demand (see lazytab.h)
+
+/// Switches to a lazily loaded table (see open_lazy_table in
+/// lazytab.h).  Only bindings made inside scopes stay in the list.
+/// @param lazy  the table
+void use_lazy_table(struct lazytab_s *lazy);
+
+/// Returns the symbol added to the table most recently.  Following
+/// next from it visits every symbol, newest to oldest.  With a shared
+/// or lazily loaded table, only the bindings of open scopes are visited.
+/// @return the newest symbol, or NULL if the table is empty
+symbol_t *newest_symbol(void);
+
+/// Opens a scope.  Until it is popped or committed, every symbol bound
+/// is local to it and lookups fall through to the enclosing scopes.
+/// Takes constant time, whatever the size of the table.
+void push_scope(void);
+
+/// Discards the innermost scope and everything bound in it.  Takes time
+/// proportional to the number of symbols bound in the scope.  Readers
+/// may run meanwhile; only one thread may open and close scopes.
+/// @return 1 if a scope was popped, 0 if none is open
+int pop_scope(void);
+
+/// Ends the innermost scope, keeping what was bound in it as bindings
+/// of the enclosing scope.  Changes only reach the change hook once
+/// they are committed to the base table.  Takes time proportional to
+/// the number of symbols bound in the scope times the lookup time.
+/// Readers may run meanwhile, and see the scope's bindings until its
+/// copies replace them all at once; only one thread may open and close
+/// scopes.
+/// @return 1 if a scope was committed, 0 if none is open
+int commit_scope(void);
+
+/// Returns how many scopes are open
+/// @return the depth of the innermost scope, 0 for the base table
+int get_scope_depth(void);
+
+/// Destroys the symbol table.  Symbols are only reclaimed here, so
+/// no other thread may be using the table when it is called.
 void free_table(void);
 
 #endif
@@ -0,0 +1,203 @@
+/*
+ * symtab_bench.c
+ *
+ * Stress benchmark for the shared symbol table. Runs 1..N reader threads
+ * doing lookups while writer threads keep updating values and adding
+ * new symbols, then reports the lookup rate for each reader count.
+ *
+ * usage: symtab_bench [max-readers] [writers] [symbols] [millis]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "symtab.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NAME_LEN 16
+
+static int num_symbols = 1000;
+static volatile int running = 0;
+static char (*names)[NAME_LEN] = NULL;
+
+// Per thread counters, padded so threads do not share cache lines
+typedef struct counter_s {
+	unsigned long ops;
+	unsigned long misses;
+	char pad[64 - 2 * sizeof(unsigned long)];
+} counter_t;
+
+/// Small xorshift generator so threads do not fight over rand()
+///
+/// @param state The generator state
+/// @return The next pseudo random number
+static unsigned next_rand(unsigned *state) {
+	unsigned x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/// Reader thread: looks up random names and reads their values
+///
+/// @param arg The counter_t to record into
+/// @return NULL
+static void *reader(void *arg) {
+	counter_t *counter = (counter_t *) arg;
+	unsigned state = (unsigned) (size_t) arg | 1;
+	unsigned long sum = 0;
+
+	while (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		// Wait for the start signal
+	}
+	while (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+		symbol_t *symbol = lookup_table(names[next_rand(&state) % num_symbols]);
+		if (symbol == NULL) {
+			counter->misses++; // Should never happen, symbols are never removed
+		} else {
+			sum += get_symbol_val(symbol);
+		}
+		counter->ops++;
+	}
+
+	return (void *) sum;
+}
+
+/// Writer thread: updates existing values and keeps adding new symbols
+///
+/// @param arg The counter_t to record into
+/// @return NULL
+static void *writer(void *arg) {
+	counter_t *counter = (counter_t *) arg;
+	unsigned state = (unsigned) (size_t) arg | 1;
+	char name[NAME_LEN];
+
+	while (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		// Wait for the start signal
+	}
+	while (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+		unsigned r = next_rand(&state);
+		if (r % 64 == 0) { // Occasionally publish a new symbol
+			snprintf(name, sizeof(name), "w%u", r % 4096);
+			bind_symbol(name, (int) r);
+		} else {
+			set_symbol_val(lookup_table(names[r % num_symbols]), (int) r);
+		}
+		counter->ops++;
+	}
+
+	return NULL;
+}
+
+/// Empties the table and fills it with just the starting symbols, so
+/// every round walks a list of the same length
+static void reset_table(void) {
+	free_table();
+	for (int i = 0; i < num_symbols; i++) {
+		create_symbol(names[i], i);
+	}
+}
+
+/// Runs one round with the given number of threads
+///
+/// @param readers The number of reader threads
+/// @param writers The number of writer threads
+/// @param millis How long to run for
+/// @param write_rate Set to the writes per second across all writers
+/// @return Lookups per second across all readers
+static double run_round(int readers, int writers, int millis, double *write_rate) {
+	pthread_t *threads = (pthread_t *) malloc(sizeof(pthread_t) * (readers + writers));
+	counter_t *counters = (counter_t *) calloc(readers + writers, sizeof(counter_t));
+	if (threads == NULL || counters == NULL) {
+		fprintf(stderr, "Error: benchmark memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < readers + writers; i++) {
+		if (pthread_create(&threads[i], NULL, i < readers ? reader : writer, &counters[i]) != 0) {
+			fprintf(stderr, "Error: could not create thread.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	__atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+	usleep(millis * 1000);
+	__atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+	for (int i = 0; i < readers + writers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	unsigned long lookups = 0;
+	unsigned long writes = 0;
+	for (int i = 0; i < readers + writers; i++) {
+		if (i < readers) {
+			lookups += counters[i].ops;
+			if (counters[i].misses) {
+				fprintf(stderr, "Error: reader %d missed %lu lookups.\n", i, counters[i].misses);
+			}
+		} else {
+			writes += counters[i].ops;
+		}
+	}
+
+	free(threads);
+	free(counters);
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	*write_rate = writes / secs;
+	return lookups / secs;
+}
+
+/// Entry point of the benchmark
+///
+/// @param argc The number of command line arguments
+/// @param argv The command line arguments
+/// @return EXIT_SUCCESS
+int main(int argc, char *argv[]) {
+	int max_readers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int writers = 1;
+	int millis = 500;
+
+	if (argc > 1) max_readers = atoi(argv[1]);
+	if (argc > 2) writers = atoi(argv[2]);
+	if (argc > 3) num_symbols = atoi(argv[3]);
+	if (argc > 4) millis = atoi(argv[4]);
+	if (max_readers < 1 || writers < 0 || num_symbols < 1 || millis < 1) {
+		fprintf(stderr, "Usage: symtab_bench [max-readers] [writers] [symbols] [millis]\n");
+		return EXIT_FAILURE;
+	}
+
+	names = malloc(sizeof(*names) * num_symbols);
+	if (names == NULL) {
+		fprintf(stderr, "Error: benchmark memory allocation failed.\n");
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < num_symbols; i++) {
+		snprintf(names[i], NAME_LEN, "s%d", i);
+	}
+
+	printf("%d symbols, %d writer(s), %d ms per round\n", num_symbols, writers, millis);
+	printf("readers  lookups/s     per reader    scaling  writes/s\n");
+	double base = 0;
+	for (int readers = 1; readers <= max_readers; readers++) {
+		double write_rate;
+		reset_table(); // Writers add names, which would make later rounds walk longer lists
+		double rate = run_round(readers, writers, millis, &write_rate);
+		if (readers == 1) {
+			base = rate;
+		}
+		printf("%7d  %12.0f  %12.0f  %7.2fx  %8.0f\n", readers, rate, rate / readers,
+			rate / base, write_rate);
+	}
+
+	free_table();
+	free(names);
+	return EXIT_SUCCESS;
+}
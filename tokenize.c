@@ -0,0 +1,426 @@
+/*
+ * tokenize.c
+ *
+ * Splits expression lines into classified tokens. The vector versions
+ * work out which bytes are spaces, digits and letters for 32 bytes at
+ * a time as bit masks, then walk the masks to find the tokens.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "tokenize.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define BLOCK 32                // bytes classified at a time
+
+// Bit i of each mask describes byte i of a block
+typedef struct block_masks_s {
+	uint32_t space;
+	uint32_t digit;
+	uint32_t alpha;
+	uint32_t alnum;
+} block_masks_t;
+
+// Bit c is set for each operation character c (they are all below 64)
+static const unsigned long long op_chars = 1ULL << '+' | 1ULL << '-' | 1ULL << '*' |
+	1ULL << '/' | 1ULL << '%' | 1ULL << '=' | 1ULL << '?';
+
+/// Checks that a line is short enough for the offsets in token_t
+///
+/// @param len The length of the line
+static void check_length(size_t len) {
+	if (len > TOKENIZE_MAX_LINE) {
+		fprintf(stderr, "Error: line is too long to tokenize.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// Makes sure the list has room for more tokens
+///
+/// @param list The list
+/// @param need The number of tokens it has to hold
+static void reserve_tokens(token_list_t *list, size_t need) {
+	if (need > list->cap) {
+		size_t cap = list->cap ? list->cap : 64;
+		while (cap < need) {
+			cap *= 2;
+		}
+		token_t *tokens = (token_t *) realloc(list->tokens, cap * sizeof(token_t));
+		if (tokens == NULL) { // Check if realloc failed
+			fprintf(stderr, "Error: token memory allocation failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		list->tokens = tokens;
+		list->cap = cap;
+	}
+}
+
+/// Stores a token in a list that already has room for it
+///
+/// @param list The list
+/// @param count The number of tokens already in the list
+/// @param start The offset of the token
+/// @param len The length of the token
+/// @param type The class of the token
+static inline void emit(token_list_t *list, size_t count, size_t start, size_t len, token_class_t type) {
+	token_t token = { (unsigned) start, (unsigned) len, type };
+	list->tokens[count] = token;
+}
+
+/// Checks if a character is one of the operation tokens
+///
+/// @param c The character
+/// @return 1 if it is an operation, 0 otherwise
+static inline int is_op_char(char c) {
+	return (unsigned char) c < 64 && (op_chars >> (unsigned char) c & 1);
+}
+
+/// Classifies a single token
+///
+/// @param token The characters of the token
+/// @param len The number of characters
+/// @return The class of the token
+token_class_t classify_token(const char *token, size_t len) {
+	if (len == 1 && is_op_char(token[0])) {
+		return TOKEN_OP;
+	}
+
+	size_t i = 0;
+	while (i < len && isdigit((unsigned char) token[i])) { // Check if every character is a number
+		i++;
+	}
+	if (i == len) {
+		return TOKEN_INT;
+	}
+
+	if (!isalpha((unsigned char) token[0])) { // Symbols have to start with a letter
+		return TOKEN_ILLEGAL;
+	}
+	for (i = 1; i < len; i++) { // The rest can be letters or numbers
+		if (!isalnum((unsigned char) token[i])) {
+			return TOKEN_ILLEGAL;
+		}
+	}
+	return TOKEN_SYMBOL;
+}
+
+/// Byte at a time reference version of tokenize
+///
+/// @param line The line
+/// @param len The number of characters in line
+/// @param list The list to fill
+/// @return The number of tokens found
+size_t tokenize_scalar(const char *line, size_t len, token_list_t *list) {
+	check_length(len);
+	size_t count = 0;
+	size_t i = 0;
+	while (i < len) {
+		if (line[i] == ' ') {
+			i++;
+			continue;
+		}
+
+		size_t start = i;
+		while (i < len && line[i] != ' ') {
+			i++;
+		}
+		reserve_tokens(list, count + 1);
+		emit(list, count++, start, i - start, classify_token(line + start, i - start));
+	}
+
+	list->count = count;
+	return count;
+}
+
+/// Builds the masks for a block one byte at a time
+///
+/// @param block The 32 bytes to classify
+/// @param masks Filled in with the masks
+static inline void masks_scalar(const char *block, block_masks_t *masks) {
+	masks->space = masks->digit = masks->alpha = 0;
+	for (int i = 0; i < BLOCK; i++) {
+		unsigned char c = (unsigned char) block[i];
+		masks->space |= (uint32_t) (c == ' ') << i;
+		masks->digit |= (uint32_t) (c >= '0' && c <= '9') << i;
+		masks->alpha |= (uint32_t) ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') << i;
+	}
+	masks->alnum = masks->digit | masks->alpha;
+}
+
+#ifdef HAVE_X86_SIMD
+/// Builds the masks for a block with SSE2, 16 bytes at a time. Bytes above
+/// 127 are negative as signed chars, so they fall outside every range.
+///
+/// @param block The 32 bytes to classify
+/// @param masks Filled in with the masks
+__attribute__((target("sse2")))
+static inline void masks_sse2(const char *block, block_masks_t *masks) {
+	uint32_t space = 0, digit = 0, alpha = 0;
+	for (int half = 0; half < 2; half++) {
+		__m128i b = _mm_loadu_si128((const __m128i *) (block + 16 * half));
+		__m128i lower = _mm_or_si128(b, _mm_set1_epi8(0x20));
+		__m128i s = _mm_cmpeq_epi8(b, _mm_set1_epi8(' '));
+		__m128i d = _mm_and_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8('0' - 1)),
+			_mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), b));
+		__m128i a = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			_mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), lower));
+		space |= (uint32_t) _mm_movemask_epi8(s) << (16 * half);
+		digit |= (uint32_t) _mm_movemask_epi8(d) << (16 * half);
+		alpha |= (uint32_t) _mm_movemask_epi8(a) << (16 * half);
+	}
+	masks->space = space;
+	masks->digit = digit;
+	masks->alpha = alpha;
+	masks->alnum = digit | alpha;
+}
+
+/// Builds the masks for a block with AVX2
+///
+/// @param block The 32 bytes to classify
+/// @param masks Filled in with the masks
+__attribute__((target("avx2")))
+static inline void masks_avx2(const char *block, block_masks_t *masks) {
+	__m256i b = _mm256_loadu_si256((const __m256i *) block);
+	__m256i lower = _mm256_or_si256(b, _mm256_set1_epi8(0x20));
+	__m256i s = _mm256_cmpeq_epi8(b, _mm256_set1_epi8(' '));
+	__m256i d = _mm256_and_si256(_mm256_cmpgt_epi8(b, _mm256_set1_epi8('0' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), b));
+	__m256i a = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+	masks->space = (uint32_t) _mm256_movemask_epi8(s);
+	masks->digit = (uint32_t) _mm256_movemask_epi8(d);
+	masks->alpha = (uint32_t) _mm256_movemask_epi8(a);
+	masks->alnum = masks->digit | masks->alpha;
+}
+#endif
+
+/// Works out the class of a token from what the masks said about it
+///
+/// @param first The first character of the token
+/// @param len The length of the token
+/// @param all_digit Whether every character is a digit
+/// @param first_alpha Whether the first character is a letter
+/// @param all_alnum Whether every character is a letter or digit
+/// @return The class of the token
+static inline token_class_t class_of(char first, size_t len, int all_digit, int first_alpha, int all_alnum) {
+	if (len == 1 && is_op_char(first)) {
+		return TOKEN_OP;
+	} else if (all_digit) {
+		return TOKEN_INT;
+	} else if (first_alpha && all_alnum) {
+		return TOKEN_SYMBOL;
+	}
+	return TOKEN_ILLEGAL;
+}
+
+/// Walks the masks of each block to find the tokens. This is inlined into
+/// one copy per instruction set so the mask builder is inlined as well.
+///
+/// @param line The line
+/// @param len The number of characters in line
+/// @param list The list to fill
+/// @param build_masks Builds the masks for one block
+/// @return The number of tokens found
+static inline __attribute__((always_inline))
+size_t tokenize_blocks(const char *line, size_t len, token_list_t *list,
+		void (*build_masks)(const char *, block_masks_t *)) {
+	block_masks_t masks;
+	char tail[BLOCK];
+	size_t count = 0;
+	size_t start = 0;
+	uint32_t carry = 0; // 1 if the last byte of the previous block was part of a token
+	int in_token = 0;
+	int all_digit = 0, all_alnum = 0, first_alpha = 0;
+
+	check_length(len);
+	for (size_t base = 0; base < len; base += BLOCK) {
+		reserve_tokens(list, count + BLOCK / 2 + 1); // The most tokens one block can end
+		if (len - base < BLOCK) {
+			// Pad the last block with spaces so the last token ends in it
+			memset(tail, ' ', BLOCK);
+			memcpy(tail, line + base, len - base);
+			build_masks(tail, &masks);
+		} else {
+			build_masks(line + base, &masks);
+		}
+
+		uint32_t word = ~masks.space;                        // bytes that belong to tokens
+		uint32_t starts = word & ~(word << 1 | carry);       // first byte of each token
+		uint32_t ends = masks.space & (word << 1 | carry);   // first space after each token
+		uint32_t not_digit = ~masks.digit;
+		uint32_t not_alnum = ~masks.alnum;
+		carry = word >> (BLOCK - 1);
+
+		if (in_token) { // Finish the token carried over from the last block
+			if (ends == 0) {
+				all_digit &= masks.digit == ~(uint32_t) 0;
+				all_alnum &= masks.alnum == ~(uint32_t) 0;
+				continue; // It covers this whole block too
+			}
+
+			unsigned end = (unsigned) __builtin_ctz(ends);
+			uint32_t run = ((uint32_t) 1 << end) - 1;
+			ends &= ends - 1;
+			all_digit &= (not_digit & run) == 0;
+			all_alnum &= (not_alnum & run) == 0;
+			size_t tok_len = base + end - start;
+			emit(list, count++, start, tok_len,
+				class_of(line[start], tok_len, all_digit, first_alpha, all_alnum));
+			in_token = 0;
+		}
+
+		// Each start pairs with the next end, unless the token runs off the block
+		while (starts != 0) {
+			unsigned pos = (unsigned) __builtin_ctz(starts);
+			uint32_t from = ~(uint32_t) 0 << pos;
+			starts &= starts - 1;
+			if (ends == 0) {
+				start = base + pos;
+				first_alpha = (masks.alpha >> pos) & 1;
+				all_digit = (not_digit & from) == 0;
+				all_alnum = (not_alnum & from) == 0;
+				in_token = 1;
+				break;
+			}
+
+			unsigned end = (unsigned) __builtin_ctz(ends);
+			uint32_t run = from & (((uint32_t) 1 << end) - 1);
+			ends &= ends - 1;
+			emit(list, count++, base + pos, end - pos,
+				class_of(line[base + pos], end - pos, (not_digit & run) == 0,
+					(masks.alpha >> pos) & 1, (not_alnum & run) == 0));
+		}
+	}
+
+	if (in_token) { // Only when the line ends exactly on a block boundary
+		reserve_tokens(list, count + 1);
+		emit(list, count++, start, len - start,
+			class_of(line[start], len - start, all_digit, first_alpha, all_alnum));
+	}
+
+	list->count = count;
+	return count;
+}
+
+/// Block version of tokenize without vector instructions
+///
+/// @param line The line
+/// @param len The number of characters in line
+/// @param list The list to fill
+/// @return The number of tokens found
+static size_t tokenize_portable(const char *line, size_t len, token_list_t *list) {
+	return tokenize_blocks(line, len, list, masks_scalar);
+}
+
+#ifdef HAVE_X86_SIMD
+/// SSE2 version of tokenize
+///
+/// @param line The line
+/// @param len The number of characters in line
+/// @param list The list to fill
+/// @return The number of tokens found
+__attribute__((target("sse2")))
+static size_t tokenize_sse2(const char *line, size_t len, token_list_t *list) {
+	return tokenize_blocks(line, len, list, masks_sse2);
+}
+
+/// AVX2 version of tokenize
+///
+/// @param line The line
+/// @param len The number of characters in line
+/// @param list The list to fill
+/// @return The number of tokens found
+__attribute__((target("avx2")))
+static size_t tokenize_avx2(const char *line, size_t len, token_list_t *list) {
+	return tokenize_blocks(line, len, list, masks_avx2);
+}
+#endif
+
+static size_t (*tokenize_fn)(const char *, size_t, token_list_t *) = NULL;
+static const char *impl_name = NULL;
+
+/// Picks the fastest implementation the CPU supports
+static void pick_impl(void) {
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		impl_name = "avx2";
+		tokenize_fn = tokenize_avx2;
+		return;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		impl_name = "sse2";
+		tokenize_fn = tokenize_sse2;
+		return;
+	}
+#endif
+	impl_name = "portable";
+	tokenize_fn = tokenize_portable;
+}
+
+/// Forces tokenize to use a particular implementation
+///
+/// @param name "avx2", "sse2" or "portable"
+/// @return 1 if it is supported on this CPU, 0 otherwise
+int tokenize_select(const char *name) {
+	if (strcmp(name, "portable") == 0) {
+		impl_name = "portable";
+		tokenize_fn = tokenize_portable;
+		return 1;
+	}
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+		impl_name = "avx2";
+		tokenize_fn = tokenize_avx2;
+		return 1;
+	}
+	if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+		impl_name = "sse2";
+		tokenize_fn = tokenize_sse2;
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+/// Splits a line into tokens using the fastest implementation available
+///
+/// @param line The line
+/// @param len The number of characters in line
+/// @param list The list to fill
+/// @return The number of tokens found
+size_t tokenize(const char *line, size_t len, token_list_t *list) {
+	if (tokenize_fn == NULL) {
+		pick_impl();
+	}
+	return tokenize_fn(line, len, list);
+}
+
+/// Names the implementation tokenize uses on this CPU
+///
+/// @return "avx2", "sse2" or "portable"
+const char *tokenize_impl(void) {
+	if (tokenize_fn == NULL) {
+		pick_impl();
+	}
+	return impl_name;
+}
+
+/// Frees the tokens of a list
+///
+/// @param list The list to clear
+void free_tokens(token_list_t *list) {
+	free(list->tokens);
+	list->tokens = NULL;
+	list->count = list->cap = 0;
+}
@@ -0,0 +1,75 @@
+/// Splitting expression lines into classified tokens
+///
+/// Tokens are separated by spaces, exactly like strtok(line, " ").
+/// Lines are classified 32 bytes at a time with AVX2 or SSE2 when the
+/// CPU has them, and with a portable loop otherwise.  Every version
+/// produces the same tokens as the byte at a time tokenize_scalar.
+
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+#include <stddef.h>
+
+// What a token looks like (decides how parse treats it)
+typedef enum token_class_e {
+    TOKEN_ILLEGAL,              // doesn't fit any other pattern
+    TOKEN_OP,                   // one of the operation tokens
+    TOKEN_INT,                  // all decimal digits
+    TOKEN_SYMBOL                // a letter followed by letters/digits
+} token_class_t;
+
+#define TOKENIZE_MAX_LINE 0x3fffffffUL  // longest line that can be tokenized
+
+// A token, as an offset into the line it came from (8 bytes, so that
+// lines with millions of tokens stay cheap)
+typedef struct token_s {
+    unsigned start;             // offset of the first character
+    unsigned len : 30;          // number of characters
+    unsigned type : 2;          // the class of the token (token_class_t)
+} token_t;
+
+// A flat, growable array of tokens
+typedef struct token_list_s {
+    token_t *tokens;            // the tokens, in line order
+    size_t count;               // the number of tokens
+    size_t cap;                 // the allocated number of tokens
+} token_list_t;
+
+/// Splits a line into tokens, replacing the contents of the list.
+/// Uses the fastest implementation the CPU supports.
+/// @param line  the line (need not be null terminated)
+/// @param len  the number of characters in line
+/// @param list  the list to fill (list->tokens may be NULL at first)
+/// @return the number of tokens found
+/// @exception If the list can't grow or the line is longer than
+///     TOKENIZE_MAX_LINE, an error message is displayed and the
+///     program exits with EXIT_FAILURE.
+size_t tokenize(const char *line, size_t len, token_list_t *list);
+
+/// Byte at a time reference version of tokenize
+/// @param line  the line (need not be null terminated)
+/// @param len  the number of characters in line
+/// @param list  the list to fill
+/// @return the number of tokens found
+size_t tokenize_scalar(const char *line, size_t len, token_list_t *list);
+
+/// Classifies a single token the same way tokenize does
+/// @param token  the characters of the token
+/// @param len  the number of characters
+/// @return the class of the token
+token_class_t classify_token(const char *token, size_t len);
+
+/// Names the implementation tokenize uses on this CPU
+/// @return "avx2", "sse2" or "portable"
+const char *tokenize_impl(void);
+
+/// Forces tokenize to use a particular implementation
+/// @param name  "avx2", "sse2" or "portable"
+/// @return 1 if it is supported on this CPU, 0 otherwise
+int tokenize_select(const char *name);
+
+/// Frees the tokens of a list (the list itself is not freed)
+/// @param list  the list to clear
+void free_tokens(token_list_t *list);
+
+#endif
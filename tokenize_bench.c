@@ -0,0 +1,224 @@
+/*
+ * tokenize_bench.c
+ *
+ * Checks every tokenize implementation the CPU supports against the
+ * byte at a time reference on a fuzzed corpus, then measures how fast
+ * each one splits a very long expression line.
+ *
+ * usage: tokenize_bench [fuzz-lines] [megabytes]
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "tokenize.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *impls[] = { "portable", "sse2", "avx2" };
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/// Seconds on the monotonic clock
+///
+/// @return The current time
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// Fills a buffer with random bytes, biased toward the interesting ones
+///
+/// @param buf The buffer
+/// @param len Its length
+static void fuzz_line(char *buf, size_t len) {
+	static const char common[] = "    0123456789abcxyzXYZ+-*/%=?";
+	static const char odd[] = "\t\n\r#_.:!\"~\x7f\x80\xc3\xff";
+	for (size_t i = 0; i < len; i++) {
+		int r = rand() % 100;
+		if (r < 85) {
+			buf[i] = common[rand() % (sizeof(common) - 1)];
+		} else if (r < 98) {
+			buf[i] = odd[rand() % (sizeof(odd) - 1)];
+		} else {
+			buf[i] = (char) (rand() % 256); // Anything, including '\0'
+		}
+	}
+}
+
+/// Compares two token lists
+///
+/// @param a The first list
+/// @param b The second list
+/// @return 1 if they hold the same tokens, 0 otherwise
+static int same_tokens(token_list_t *a, token_list_t *b) {
+	if (a->count != b->count) {
+		return 0;
+	}
+	for (size_t i = 0; i < a->count; i++) {
+		if (a->tokens[i].start != b->tokens[i].start || a->tokens[i].len != b->tokens[i].len ||
+			a->tokens[i].type != b->tokens[i].type) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/// Runs the fuzzed comparison
+///
+/// @param lines The number of lines to try
+/// @return The number of mismatches
+static int fuzz(int lines) {
+	token_list_t expect = { NULL, 0, 0 };
+	token_list_t got = { NULL, 0, 0 };
+	char *buf = (char *) malloc(4096);
+	int bad = 0;
+	if (buf == NULL) {
+		fprintf(stderr, "Error: benchmark memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	srand(243);
+	for (int n = 0; n < lines; n++) {
+		size_t len = rand() % 8 == 0 ? (size_t) (rand() % 4096) : (size_t) (rand() % 100);
+		fuzz_line(buf, len);
+		tokenize_scalar(buf, len, &expect);
+
+		for (size_t i = 0; i < NUM_IMPLS; i++) {
+			if (!tokenize_select(impls[i])) {
+				continue;
+			}
+			tokenize(buf, len, &got);
+			if (!same_tokens(&expect, &got)) {
+				if (bad++ < 10) {
+					fprintf(stderr, "Mismatch: %s on line %d (length %zu)\n", impls[i], n, len);
+				}
+			}
+		}
+	}
+
+	free(buf);
+	free_tokens(&expect);
+	free_tokens(&got);
+	return bad;
+}
+
+// Short tokens, close to the worst case, and generated-code style long ones
+static const char *dense[] = { "123", "x", "+", "alpha7", "42", "*", "y", "-", "9000", "%", "zz", "=", NULL };
+static const char *sparse[] = { "accumulator0017", "1234567890", "+", "intermediateValue42",
+	"*", "987654321", "loopCounterOuter", "-", "=", NULL };
+
+/// Builds one long postfix expression line
+///
+/// @param len The length of the line
+/// @param pieces The tokens to repeat (NULL terminated)
+/// @return The line
+static char *long_line(size_t len, const char **pieces) {
+	char *line = (char *) malloc(len + 1);
+	if (line == NULL) {
+		fprintf(stderr, "Error: benchmark memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t at = 0;
+	for (unsigned i = 0; at < len; i++) {
+		const char *piece = pieces[i];
+		if (piece == NULL) {
+			piece = pieces[i = 0];
+		}
+		size_t n = strlen(piece);
+		if (n > len - at) {
+			n = len - at; // The last piece is cut off at the end of the line
+		}
+		memcpy(line + at, piece, n);
+		at += n;
+		if (at < len) {
+			line[at++] = ' ';
+		}
+	}
+	line[len] = '\0';
+	return line;
+}
+
+/// Times one implementation on the line, best of three runs
+///
+/// @param fn The implementation
+/// @param line The line
+/// @param len The length of the line
+/// @param list Filled in with the tokens
+/// @return The best time in seconds
+static double time_impl(size_t (*fn)(const char *, size_t, token_list_t *), const char *line,
+		size_t len, token_list_t *list) {
+	double best = 1e9;
+	for (int run = 0; run < 3; run++) {
+		double start = now();
+		fn(line, len, list);
+		double secs = now() - start;
+		if (secs < best) {
+			best = secs;
+		}
+	}
+	return best;
+}
+
+/// Splits the line the way interp used to, with strtok
+///
+/// @param line The line
+/// @param len The length of the line
+/// @param list Filled in with the tokens
+/// @return The number of tokens
+static size_t tokenize_strtok(const char *line, size_t len, token_list_t *list) {
+	char *copy = strdup(line);
+	size_t count = 0;
+	if (copy == NULL) {
+		fprintf(stderr, "Error: benchmark memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	for (char *token = strtok(copy, " "); token != NULL; token = strtok(NULL, " ")) {
+		count += classify_token(token, strlen(token)) != TOKEN_ILLEGAL;
+	}
+	free(copy);
+	list->count = count;
+	(void) len;
+	return count;
+}
+
+/// Entry point of the benchmark
+///
+/// @param argc The number of command line arguments
+/// @param argv The command line arguments
+/// @return EXIT_SUCCESS if every implementation matched, EXIT_FAILURE otherwise
+int main(int argc, char *argv[]) {
+	int lines = argc > 1 ? atoi(argv[1]) : 200000;
+	size_t megabytes = argc > 2 ? (size_t) atoi(argv[2]) : 64;
+
+	int bad = fuzz(lines);
+	printf("fuzz: %d lines, %d mismatches\n", lines, bad);
+
+	size_t len = megabytes << 20;
+	token_list_t list = { NULL, 0, 0 };
+	for (int corpus = 0; corpus < 2; corpus++) {
+		char *line = long_line(len, corpus ? sparse : dense);
+		tokenize_scalar(line, len, &list);
+		printf("%zu MB line of %s tokens (%.1f bytes per token):\n", megabytes,
+			corpus ? "long" : "short", (double) len / list.count);
+
+		double secs = time_impl(tokenize_strtok, line, len, &list); // strtok copies, so it includes a strdup
+		printf("  %-9s %7.2f GB/s\n", "strtok", len / secs / 1e9);
+		secs = time_impl(tokenize_scalar, line, len, &list);
+		printf("  %-9s %7.2f GB/s\n", "scalar", len / secs / 1e9);
+		for (size_t i = 0; i < NUM_IMPLS; i++) {
+			if (!tokenize_select(impls[i])) {
+				printf("  %-9s unsupported\n", impls[i]);
+				continue;
+			}
+			secs = time_impl(tokenize, line, len, &list);
+			printf("  %-9s %7.2f GB/s\n", impls[i], len / secs / 1e9);
+		}
+		free(line);
+	}
+
+	free_tokens(&list);
+	return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
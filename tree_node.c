@@ -23,6 +23,7 @@ tree_node_t *make_interior(op_type_t op, char *token, tree_node_t *left, tree_no
     	}
 
     	node->type = INTERIOR;
+    	node->flags = 0;
     	node->token = strdup(token);
     	if (node->token == NULL) { // Check if strdup failed
         	fprintf(stderr, "Error: String duplication failed.\n");
@@ -62,6 +63,7 @@ tree_node_t *make_leaf(exp_type_t exp_type, char *token) {
     	}
 
     	node->type = LEAF;
+    	node->flags = 0;
     	node->token = strdup(token);
     	if (node->token == NULL) { // Check if strdup failed
         	fprintf(stderr, "Error: String duplication failed.\n");
@@ -3,6 +3,7 @@
 #ifndef TREE_NODE_H
 #define TREE_NODE_H
 
+#include "fastdiv.h"
 #include "symtab.h"
 
 // Operation tokens
@@ -39,9 +40,17 @@ typedef enum node_type_e {
     LEAF
 } node_type_t;
 
+// Facts the validator proved about a node (see validate.h)
+#define NODE_MAY_FAIL   0x1     // evaluating the subtree may set error_flag
+#define NODE_CHECK      0x2     // divisor may be zero / symbol may be unbound
+#define NODE_CONST      0x4     // the subtree always has the same value
+#define NODE_VALID      0x8     // (root only) the whole tree is well formed
+#define NODE_FASTDIV    0x10    // a / or % whose constant divisor is in div
+
 // Represents a node in the parse tree
 typedef struct tree_node_s {
     node_type_t type;           // the type of the node
+    unsigned flags;             // NODE_* flags, 0 until validated
     char *token;                // the token that derived this node
     void *node;                 // either an interiorNode or leafNode
 } tree_node_t;
@@ -50,6 +59,7 @@ typedef struct interior_node_s {
     op_type_t op;                  // the operation at this interior node
     tree_node_t *left;          // the left operand
     tree_node_t *right;         // the right operand
+    fastdiv_t div;              // the divisor, if flags has NODE_FASTDIV
 } interior_node_t;
 
 typedef struct leaf_node_s {
@@ -0,0 +1,347 @@
+/*
+ * validate.c
+ *
+ * The static validator and the evaluator it enables. The validator
+ * folds constant subtrees so that divisions by a non-zero constant need
+ * no check, and remembers the symbols assigned earlier in evaluation
+ * order so that reading them back needs no lookup failure check.
+ * Constant divisors get their magic numbers (see fastdiv.h) here too.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "validate.h"
+#include "fastdiv.h"
+#include "parser.h"
+#include "symtab.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIVISOR_CACHE 64        // symbol divisors remembered by eval_fast (a power of two)
+
+// Magic numbers for the divisors symbols held lately, by value
+static fastdiv_t divisors[DIVISOR_CACHE];
+
+// Symbols certain to be bound by the time the node being validated runs
+typedef struct bound_s {
+	char **names;           // assigned names, in evaluation order
+	size_t count;           // the number of names
+	size_t cap;             // the allocated number of names
+} bound_t;
+
+/// Notes that a symbol is bound from here on
+///
+/// @param bound The symbols assigned so far
+/// @param name The symbol that was assigned
+static void add_bound(bound_t *bound, char *name) {
+	if (bound->count == bound->cap) {
+		size_t cap = bound->cap ? bound->cap * 2 : 8;
+		char **names = (char **) realloc(bound->names, cap * sizeof(char *));
+		if (names == NULL) { // Check if realloc failed
+			fprintf(stderr, "Error: Validator memory allocation failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		bound->names = names;
+		bound->cap = cap;
+	}
+	bound->names[bound->count++] = name;
+}
+
+/// Checks whether a symbol is certain to be bound when it is read
+///
+/// Only assignments earlier in the line count. Asking the table would
+/// cost a second lookup, and eval_fast has to look the symbol up anyway.
+///
+/// @param bound The symbols assigned earlier in evaluation order
+/// @param name The symbol being read
+/// @return 1 if it is bound, 0 if the lookup may fail
+static int is_bound(bound_t *bound, char *name) {
+	for (size_t i = 0; i < bound->count; i++) {
+		if (strcmp(bound->names[i], name) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/// Computes left op right for two constants the way eval_tree would
+///
+/// @param op The operation (not division by zero or INT_MIN / -1)
+/// @param left The left operand
+/// @param right The right operand
+/// @return The result
+static int fold(op_type_t op, int left, int right) {
+	switch (op) { // Wrap around like the hardware instead of overflowing
+		case ADD_OP: return (int) ((unsigned) left + (unsigned) right);
+		case SUB_OP: return (int) ((unsigned) left - (unsigned) right);
+		case MUL_OP: return (int) ((unsigned) left * (unsigned) right);
+		case DIV_OP: return left / right;
+		default: return left % right;
+	}
+}
+
+/// Prints a warning about part of a tree to standard error
+///
+/// @param before The text before the subtree
+/// @param node The subtree, printed in infix
+/// @param after The text after the subtree
+static void warn_about(const char *before, tree_node_t *node, const char *after) {
+	fprintf(stderr, "Warning: %s", before);
+	fprint_infix(stderr, node);
+	fprintf(stderr, "%s\n", after);
+}
+
+/// Validates a subtree, setting the flags of every node in it
+///
+/// @param node The subtree to validate
+/// @param bound The symbols assigned earlier in evaluation order (grown
+///     by any assignment the subtree always makes)
+/// @param warn Non-zero to print warnings
+/// @param val Set to the value of the subtree if it is NODE_CONST
+/// @return 1 if the subtree is well formed, 0 otherwise
+static int analyze(tree_node_t *node, bound_t *bound, int warn, int *val) {
+	node->flags = 0;
+
+	if (node->type == LEAF) {
+		leaf_node_t *leaf = (leaf_node_t *) node->node;
+		if (leaf->exp_type == INTEGER) {
+			*val = strtol(node->token, NULL, 10);
+			node->flags = NODE_CONST;
+			return 1;
+		} else if (leaf->exp_type == SYMBOL) {
+			if (!is_bound(bound, node->token)) {
+				node->flags = NODE_MAY_FAIL | NODE_CHECK;
+				if (warn && lookup_table(node->token) == NULL) { // Only the warning needs the table
+					fprintf(stderr, "Warning: Symbol %s may be unbound.\n", node->token);
+				}
+			}
+			return 1;
+		}
+		return 0; // Unknown expression type
+	} else if (node->type != INTERIOR) {
+		return 0; // Unknown node type
+	}
+
+	interior_node_t *interior = (interior_node_t *) node->node;
+	tree_node_t *left = interior->left;
+	tree_node_t *right = interior->right;
+	int left_val = 0;
+	int right_val = 0;
+
+	switch (interior->op) {
+		case ASSIGN_OP:
+			if (left->type != LEAF || ((leaf_node_t *) left->node)->exp_type != SYMBOL) {
+				if (warn) {
+					warn_about("", left, " is not a valid l-value.");
+				}
+				return 0;
+			}
+			left->flags = 0; // Written, never read
+			if (!analyze(right, bound, warn, &right_val)) {
+				return 0;
+			}
+			node->flags = NODE_MAY_FAIL; // A shared table can be full
+			add_bound(bound, left->token); // Bound for everything evaluated after this
+			return 1;
+
+		case Q_OP: {
+			if (right->type != INTERIOR || ((interior_node_t *) right->node)->op != ALT_OP) {
+				return 0; // Only the parser builds these, but check anyway
+			}
+			interior_node_t *alt = (interior_node_t *) right->node;
+			if (!analyze(left, bound, warn, &left_val)) {
+				return 0;
+			}
+
+			// Only one arm runs, so neither one's assignments can be relied on afterwards
+			size_t mark = bound->count;
+			int true_val = 0;
+			int false_val = 0;
+			if (!analyze(alt->left, bound, warn, &true_val)) {
+				return 0;
+			}
+			bound->count = mark;
+			if (!analyze(alt->right, bound, warn, &false_val)) {
+				return 0;
+			}
+			bound->count = mark;
+
+			right->flags = (alt->left->flags | alt->right->flags) & NODE_MAY_FAIL;
+			node->flags = (left->flags | right->flags) & NODE_MAY_FAIL;
+			if (left->flags & NODE_CONST) {
+				tree_node_t *taken = left_val ? alt->left : alt->right;
+				if (taken->flags & NODE_CONST) {
+					node->flags |= NODE_CONST;
+					*val = left_val ? true_val : false_val;
+				}
+			}
+			return 1;
+		}
+
+		case ADD_OP:
+		case SUB_OP:
+		case MUL_OP:
+		case DIV_OP:
+		case MOD_OP:
+			if (!analyze(left, bound, warn, &left_val) || !analyze(right, bound, warn, &right_val)) {
+				return 0;
+			}
+			node->flags = (left->flags | right->flags) & NODE_MAY_FAIL;
+
+			if (interior->op == DIV_OP || interior->op == MOD_OP) {
+				if (!(right->flags & NODE_CONST) || right_val == 0) {
+					node->flags |= NODE_MAY_FAIL | NODE_CHECK;
+					if (warn) {
+						warn_about("Divisor ", right, right->flags & NODE_CONST ?
+							" is always zero." : " may be zero.");
+					}
+					return 1;
+				}
+				if (left_val == INT_MIN && right_val == -1) {
+					return 1; // Traps at run time, don't fold it now
+				}
+				if (right_val < -1 || right_val > 1) {
+					node->flags |= NODE_FASTDIV;
+					fastdiv_init(&interior->div, right_val);
+				}
+			}
+
+			if ((left->flags & NODE_CONST) && (right->flags & NODE_CONST)) {
+				node->flags |= NODE_CONST;
+				*val = fold(interior->op, left_val, right_val);
+			}
+			return 1;
+
+		default:
+			return 0; // Unknown operation, or an alternative outside of a ?:
+	}
+}
+
+/// Validates a tree and records what was proven in its nodes
+///
+/// @param root The root of the parse tree
+/// @param warn Non-zero to print warnings to standard error
+/// @return 1 if the tree is well formed, 0 otherwise
+int validate_tree(tree_node_t *root, int warn) {
+	bound_t bound = { NULL, 0, 0 };
+	int val;
+	int valid = analyze(root, &bound, warn, &val);
+	free(bound.names);
+
+	if (valid) {
+		root->flags |= NODE_VALID;
+	} else {
+		root->flags &= ~NODE_VALID;
+	}
+	return valid;
+}
+
+/// Finds the magic numbers for a divisor a symbol holds, working them
+/// out if it held something else last time. Entries are found by the
+/// value itself, so assigning the symbol never leaves a stale one behind,
+/// whichever scope or process (with --shm) assigned it.
+///
+/// @param d The divisor, |d| >= 2
+/// @return Its magic numbers
+static const fastdiv_t *symbol_divisor(int d) {
+	fastdiv_t *div = &divisors[(unsigned) d % DIVISOR_CACHE];
+	if (div->d != d) { // Empty entries hold 0, which no divisor here is
+		fastdiv_init(div, d);
+	}
+	return div;
+}
+
+/// Evaluates a validated subtree
+///
+/// @param node The subtree to evaluate
+/// @return The evaluated integer value, or -1 if an error occurs
+static int eval_fast(tree_node_t *node) {
+	if (node->type == LEAF) {
+		if (((leaf_node_t *) node->node)->exp_type == INTEGER) {
+			return strtol(node->token, NULL, 10);
+		}
+
+		symbol_t *symbol = lookup_table(node->token);
+		if ((node->flags & NODE_CHECK) && symbol == NULL) {
+			eval_fail(UNDEFINED_SYMBOL);
+			return -1;
+		}
+		return get_symbol_val(symbol);
+	}
+
+	interior_node_t *interior = (interior_node_t *) node->node;
+	tree_node_t *left = interior->left;
+	tree_node_t *right = interior->right;
+
+	if (interior->op == ASSIGN_OP) {
+		int val = eval_fast(right);
+		if ((right->flags & NODE_MAY_FAIL) && error_flag) {
+			return -1; // Propagate error
+		}
+		if (bind_symbol(left->token, val) == NULL) {
+			eval_fail(SYMTAB_FULL);
+			return -1;
+		}
+		return val;
+
+	} else if (interior->op == Q_OP) {
+		int test_val = eval_fast(left);
+		if ((left->flags & NODE_MAY_FAIL) && error_flag) {
+			return -1; // Propagate error
+		}
+		interior_node_t *alt = (interior_node_t *) right->node;
+		return eval_fast(test_val ? alt->left : alt->right);
+	}
+
+	int left_val = eval_fast(left);
+	if ((left->flags & NODE_MAY_FAIL) && error_flag) {
+		return -1; // Propagate error
+	}
+	if (node->flags & NODE_FASTDIV) { // A constant has no effects, so skip evaluating it
+		return interior->op == DIV_OP ? fastdiv_div(&interior->div, left_val) : fastdiv_mod(&interior->div, left_val);
+	}
+	int right_val = eval_fast(right);
+	if ((right->flags & NODE_MAY_FAIL) && error_flag) {
+		return -1; // Propagate error
+	}
+
+	switch (interior->op) {
+		case ADD_OP: return left_val + right_val;
+		case SUB_OP: return left_val - right_val;
+		case MUL_OP: return left_val * right_val;
+		case DIV_OP:
+			if ((node->flags & NODE_CHECK) && right_val == 0) {
+				eval_fail(DIVISION_BY_ZERO);
+				return -1;
+			}
+			if (right->type == LEAF && (right_val < -1 || right_val > 1)) {
+				return fastdiv_div(symbol_divisor(right_val), left_val);
+			}
+			return left_val / right_val;
+		default: // MOD_OP, the validator lets nothing else through
+			if ((node->flags & NODE_CHECK) && right_val == 0) {
+				eval_fail(DIVISION_BY_ZERO);
+				return -1;
+			}
+			if (right->type == LEAF && (right_val < -1 || right_val > 1)) {
+				return fastdiv_mod(symbol_divisor(right_val), left_val);
+			}
+			return left_val % right_val;
+	}
+}
+
+/// Evaluates a tree, using the fast evaluator if it was validated
+///
+/// @param root The root of the parse tree
+/// @return The evaluated integer value, or -1 if an error occurs
+int eval_validated(tree_node_t *root) {
+	if (!(root->flags & NODE_VALID)) {
+		return eval_tree(root);
+	}
+	if (error_flag) {
+		return -1; // Same as eval_tree
+	}
+	return eval_fast(root);
+}
@@ -0,0 +1,35 @@
+/// Static validation of parse trees
+///
+/// validate_tree walks a freshly parsed tree once and proves what it
+/// can before it is evaluated: that every node has a known type and
+/// operation, that every ?: has its alternatives and every = assigns to
+/// a symbol, which divisors may be zero and which symbols may be
+/// unbound.  Trees that pass are evaluated by eval_validated, which
+/// only checks for division by zero and undefined symbols at the sites
+/// the validator could not clear, and only tests error_flag after
+/// subtrees that may set it.  The errors it reports, and when, are
+/// exactly those eval_tree would report.
+
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include "tree_node.h"
+
+/// Validates a tree and records what was proven in the flags of its
+/// nodes.  A symbol read is only proven bound if the tree assigns it
+/// earlier; every other read is checked when it is evaluated.  Only
+/// warnings look at the symbol table.
+/// @param root  the root of the parse tree
+/// @param warn  non-zero to describe each divisor that may be zero,
+///     symbol that may be unbound and invalid l-value on standard error
+/// @return 1 if the tree is well formed, 0 if it must be evaluated by
+///     eval_tree (it is going to fail with an error eval_tree reports)
+int validate_tree(tree_node_t *root, int warn);
+
+/// Evaluates a tree, skipping the checks validate_tree proved
+/// unnecessary.  Trees that did not pass are handed to eval_tree.
+/// @param root  the root of the parse tree
+/// @return the evaluated int, or -1 if error_flag was set
+int eval_validated(tree_node_t *root);
+
+#endif
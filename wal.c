@@ -0,0 +1,475 @@
+/*
+ * wal.c
+ *
+ * Write-ahead logging of symbol table changes. A hook in symtab.c
+ * encodes every change into a buffer; wal_commit writes the buffer at
+ * the end of each input line and a background thread syncs the log
+ * file, so that one sync covers every line written since the last one.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "wal.h"
+#include "symtab.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RECORD_HEADER 20        // crc, seq, val and len
+#define WAL_BUFFER 65536        // write the buffer early once it is this big
+
+// The open log (one per process)
+static struct {
+	int fd;                         // the log file, -1 if no log is open
+	char *log_path;                 // DIR/log
+	char *checkpoint_path;          // DIR/checkpoint
+	char *temp_path;                // DIR/checkpoint.tmp
+	char *dir;                      // the directory itself
+	unsigned long long next_seq;    // sequence number of the next record
+	unsigned long long pending;     // records since the last checkpoint
+	unsigned long long every;       // records between checkpoints
+	unsigned char *buf;             // records not written yet
+	size_t len;                     // bytes in buf
+	size_t cap;                     // allocated size of buf
+	int dirty;                      // written since the syncer last synced
+	int stop;                       // tells the syncer to finish
+	pthread_t syncer;               // the thread that syncs the log
+	pthread_mutex_t lock;           // guards everything above
+	pthread_cond_t wake;            // signalled when dirty is set
+} wal = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static unsigned long crc_table[256];
+
+/// Fills in the CRC-32 lookup table
+static void init_crc(void) {
+	for (unsigned long n = 0; n < 256; n++) {
+		unsigned long c = n;
+		for (int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+		}
+		crc_table[n] = c;
+	}
+}
+
+/// Computes the CRC-32 of some bytes
+///
+/// @param data The bytes
+/// @param len The number of bytes
+/// @return The CRC
+static unsigned long crc32(const unsigned char *data, size_t len) {
+	unsigned long c = 0xffffffffUL;
+	for (size_t i = 0; i < len; i++) {
+		c = crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+	}
+	return c ^ 0xffffffffUL;
+}
+
+/// Stores a 32 bit little endian integer
+///
+/// @param dest Where to store it
+/// @param val The value
+static void put_u32(unsigned char *dest, unsigned long val) {
+	for (int i = 0; i < 4; i++) {
+		dest[i] = (unsigned char) (val >> (8 * i));
+	}
+}
+
+/// Stores a 64 bit little endian integer
+///
+/// @param dest Where to store it
+/// @param val The value
+static void put_u64(unsigned char *dest, unsigned long long val) {
+	for (int i = 0; i < 8; i++) {
+		dest[i] = (unsigned char) (val >> (8 * i));
+	}
+}
+
+/// Loads a 32 bit little endian integer
+///
+/// @param src Where to load it from
+/// @return The value
+static unsigned long get_u32(const unsigned char *src) {
+	return (unsigned long) src[0] | (unsigned long) src[1] << 8 |
+		(unsigned long) src[2] << 16 | (unsigned long) src[3] << 24;
+}
+
+/// Loads a 64 bit little endian integer
+///
+/// @param src Where to load it from
+/// @return The value
+static unsigned long long get_u64(const unsigned char *src) {
+	return (unsigned long long) get_u32(src) | (unsigned long long) get_u32(src + 4) << 32;
+}
+
+/// Reports a failed system call on a log file and exits
+///
+/// @param path The file it failed on
+static void wal_fail(char *path) {
+	perror(path);
+	exit(EXIT_FAILURE);
+}
+
+/// Builds the path of a file in the log directory
+///
+/// @param dir The directory
+/// @param name The file name
+/// @return The path (on the heap)
+static char *join_path(char *dir, char *name) {
+	char *path = (char *) malloc(strlen(dir) + strlen(name) + 2);
+	if (path == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: log memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+/// Writes the buffered records to the log file (wal.lock held)
+static void flush_log(void) {
+	size_t done = 0;
+	while (done < wal.len) {
+		ssize_t n = write(wal.fd, wal.buf + done, wal.len - done);
+		if (n < 0 && errno != EINTR) {
+			wal_fail(wal.log_path);
+		}
+		done += n > 0 ? (size_t) n : 0;
+	}
+	if (wal.len > 0) {
+		wal.len = 0;
+		wal.dirty = 1;
+		pthread_cond_signal(&wal.wake);
+	}
+}
+
+/// Appends a record for a change to the buffer (the symtab hook)
+///
+/// @param symbol The symbol that was created or changed
+static void log_change(symbol_t *symbol) {
+	size_t name_len = strlen(symbol->var_name);
+	pthread_mutex_lock(&wal.lock);
+
+	if (wal.len + RECORD_HEADER + name_len > wal.cap) {
+		size_t cap = wal.cap ? wal.cap : WAL_BUFFER;
+		while (cap < wal.len + RECORD_HEADER + name_len) {
+			cap *= 2;
+		}
+		unsigned char *buf = (unsigned char *) realloc(wal.buf, cap);
+		if (buf == NULL) { // Check if realloc failed
+			fprintf(stderr, "Error: log memory allocation failed.\n");
+			exit(EXIT_FAILURE);
+		}
+		wal.buf = buf;
+		wal.cap = cap;
+	}
+
+	unsigned char *rec = wal.buf + wal.len;
+	put_u64(rec + 4, wal.next_seq++);
+	put_u32(rec + 12, (unsigned long) get_symbol_val(symbol));
+	put_u32(rec + 16, name_len);
+	memcpy(rec + RECORD_HEADER, symbol->var_name, name_len);
+	put_u32(rec, crc32(rec + 4, RECORD_HEADER - 4 + name_len));
+	wal.len += RECORD_HEADER + name_len;
+	wal.pending++;
+
+	if (wal.len >= WAL_BUFFER) {
+		flush_log(); // A single line that changes a lot of symbols
+	}
+	pthread_mutex_unlock(&wal.lock);
+}
+
+/// Syncs the log whenever it has been written to, at most once every
+/// WAL_SYNC_MS, until wal_close stops it
+///
+/// @param arg Unused
+/// @return NULL
+static void *sync_loop(void *arg) {
+	struct timespec pause = { 0, WAL_SYNC_MS * 1000000L };
+	(void) arg;
+
+	pthread_mutex_lock(&wal.lock);
+	for (;;) {
+		while (!wal.dirty && !wal.stop) {
+			pthread_cond_wait(&wal.wake, &wal.lock);
+		}
+		if (!wal.dirty) {
+			break; // Stopped with nothing left to sync
+		}
+		wal.dirty = 0;
+		pthread_mutex_unlock(&wal.lock);
+
+		// Everything written while this runs waits for the next round, together
+		if (fdatasync(wal.fd) != 0) {
+			wal_fail(wal.log_path);
+		}
+		nanosleep(&pause, NULL);
+		pthread_mutex_lock(&wal.lock);
+	}
+	pthread_mutex_unlock(&wal.lock);
+	return NULL;
+}
+
+/// Syncs a directory so that a rename in it is durable
+///
+/// @param dir The directory
+static void sync_dir(char *dir) {
+	int fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0 || fsync(fd) != 0) {
+		wal_fail(dir);
+	}
+	close(fd);
+}
+
+/// Writes the whole table as a new checkpoint and empties the log
+/// (wal.lock held)
+static void write_checkpoint(void) {
+	flush_log(); // The checkpoint covers every record so far
+
+	// Bindings in open scopes are not committed, so they are left out
+	size_t count = 0;
+	for (symbol_t *sym = newest_symbol(); sym != NULL; sym = sym->next) {
+		count += sym->depth == 0;
+	}
+	symbol_t **order = (symbol_t **) malloc((count ? count : 1) * sizeof(symbol_t *));
+	if (order == NULL) { // Check if malloc failed
+		fprintf(stderr, "Error: log memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t i = count;
+	for (symbol_t *sym = newest_symbol(); sym != NULL && i > 0; sym = sym->next) {
+		if (sym->depth == 0) {
+			order[--i] = sym; // Oldest first, so loading it rebuilds the same list
+		}
+	}
+
+	FILE *out = fopen(wal.temp_path, "w");
+	if (out == NULL) { // Check if file open failed
+		wal_fail(wal.temp_path);
+	}
+	fprintf(out, "# interp checkpoint, log sequence %llu\n", wal.next_seq - 1);
+	for (i = 0; i < count; i++) {
+		fprintf(out, "%s %d\n", order[i]->var_name, get_symbol_val(order[i]));
+	}
+	free(order);
+	if (fflush(out) != 0 || fsync(fileno(out)) != 0 || fclose(out) != 0) {
+		wal_fail(wal.temp_path);
+	}
+
+	// Only drop the log once the new checkpoint is certain to be there
+	if (rename(wal.temp_path, wal.checkpoint_path) != 0) {
+		wal_fail(wal.checkpoint_path);
+	}
+	sync_dir(wal.dir);
+	if (ftruncate(wal.fd, 0) != 0) {
+		wal_fail(wal.log_path);
+	}
+	wal.pending = 0;
+}
+
+/// Loads the checkpoint, if there is one
+///
+/// @param seq Set to the sequence number of the last record it includes
+/// @return 1 if there was a checkpoint, 0 otherwise
+static int load_checkpoint(unsigned long long *seq) {
+	FILE *in = fopen(wal.checkpoint_path, "r");
+	if (in == NULL) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+		wal_fail(wal.checkpoint_path);
+	}
+
+	char *line = NULL;
+	size_t cap = 0;
+	*seq = 0;
+	while (getline(&line, &cap, in) >= 0) {
+		if (line[0] == '#') {
+			sscanf(line, "# interp checkpoint, log sequence %llu", seq);
+			continue;
+		}
+
+		// Same format as build_table reads, but names can be any length
+		char *name = line;
+		while (isspace((unsigned char) *name)) {
+			name++;
+		}
+		char *end = name;
+		while (isalnum((unsigned char) *end)) {
+			end++;
+		}
+		char *rest;
+		long val = strtol(end, &rest, 10);
+		if (!isalpha((unsigned char) *name) || !isspace((unsigned char) *end) || rest == end ||
+			(*rest != '\n' && *rest != '\0')) {
+			fprintf(stderr, "Error: Checkpoint %s is corrupt.\n", wal.checkpoint_path);
+			exit(EXIT_FAILURE);
+		}
+		*end = '\0';
+		create_symbol(name, (int) val);
+	}
+
+	free(line);
+	fclose(in);
+	return 1;
+}
+
+/// Replays the records of the log that come after the checkpoint, and
+/// cuts off a record that was torn by a crash
+///
+/// @param seq The sequence number of the last record in the checkpoint
+/// @return The number of records replayed
+static unsigned long long replay_log(unsigned long long seq) {
+	struct stat st;
+	if (fstat(wal.fd, &st) != 0) {
+		wal_fail(wal.log_path);
+	}
+	wal.next_seq = seq + 1;
+	if (st.st_size == 0) {
+		return 0;
+	}
+
+	unsigned char *map = (unsigned char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, wal.fd, 0);
+	if (map == MAP_FAILED) {
+		wal_fail(wal.log_path);
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	const unsigned char *pos = map;
+	const unsigned char *end = map + st.st_size;
+	unsigned long long expect = 0;
+	unsigned long long replayed = 0;
+	char *name = NULL;
+	size_t name_cap = 0;
+	while ((size_t) (end - pos) >= RECORD_HEADER) {
+		size_t len = get_u32(pos + 16);
+		if ((size_t) (end - pos) - RECORD_HEADER < len || crc32(pos + 4, RECORD_HEADER - 4 + len) != get_u32(pos)) {
+			break; // Torn by the crash
+		}
+		unsigned long long rec_seq = get_u64(pos + 4);
+		if (expect == 0 && rec_seq > seq + 1) {
+			fprintf(stderr, "Error: %s is missing the records after its checkpoint.\n", wal.log_path);
+			exit(EXIT_FAILURE);
+		}
+		if (expect != 0 && rec_seq != expect) {
+			break; // Left over from before a truncation the crash interrupted
+		}
+		expect = rec_seq + 1;
+
+		if (rec_seq > seq) { // Older records are already in the checkpoint
+			if (len + 1 > name_cap) {
+				name_cap = len + 1;
+				name = (char *) realloc(name, name_cap);
+				if (name == NULL) { // Check if realloc failed
+					fprintf(stderr, "Error: log memory allocation failed.\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			memcpy(name, pos + RECORD_HEADER, len);
+			name[len] = '\0';
+			bind_symbol(name, (int) get_u32(pos + 12));
+			wal.next_seq = rec_seq + 1;
+			replayed++;
+		}
+		pos += RECORD_HEADER + len;
+	}
+
+	if (pos != end) {
+		fprintf(stderr, "Warning: Dropped a torn record at the end of %s.\n", wal.log_path);
+		if (ftruncate(wal.fd, pos - map) != 0) {
+			wal_fail(wal.log_path);
+		}
+	}
+	free(name);
+	munmap(map, st.st_size);
+	return replayed;
+}
+
+/// Opens the log, recovering the table from it if there is one
+///
+/// @param dir The directory holding the checkpoint and log
+/// @param table The symbol table file, or NULL for an empty table
+/// @param checkpoint_every Log records between checkpoints
+/// @return 1 if the table was recovered, 0 otherwise
+int wal_open(char *dir, char *table, unsigned long long checkpoint_every) {
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+		wal_fail(dir);
+	}
+	init_crc();
+	wal.dir = dir;
+	wal.log_path = join_path(dir, "log");
+	wal.checkpoint_path = join_path(dir, "checkpoint");
+	wal.temp_path = join_path(dir, "checkpoint.tmp");
+	wal.every = checkpoint_every;
+
+	wal.fd = open(wal.log_path, O_RDWR | O_CREAT | O_APPEND, 0666);
+	if (wal.fd < 0) { // Check if file open failed
+		wal_fail(wal.log_path);
+	}
+
+	unsigned long long seq = 0;
+	int recovered = load_checkpoint(&seq);
+	unsigned long long replayed = replay_log(seq);
+	if (recovered || replayed > 0) {
+		recovered = 1;
+		wal.pending = replayed;
+		fprintf(stderr, "Recovered %s: checkpoint at record %llu, %llu records replayed.\n",
+			dir, seq, replayed);
+	} else {
+		if (table != NULL) {
+			build_table(table);
+		}
+		write_checkpoint(); // The starting table is the first checkpoint
+	}
+
+	if (pthread_create(&wal.syncer, NULL, sync_loop, NULL) != 0) {
+		fprintf(stderr, "Error: Could not start the log thread.\n");
+		exit(EXIT_FAILURE);
+	}
+	set_symtab_hook(log_change);
+	return recovered;
+}
+
+/// Ends a group of changes, writing them out
+void wal_commit(void) {
+	if (wal.fd < 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&wal.lock);
+	flush_log();
+	if (wal.pending >= wal.every) {
+		write_checkpoint();
+	}
+	pthread_mutex_unlock(&wal.lock);
+}
+
+/// Writes a final checkpoint and closes the log
+void wal_close(void) {
+	if (wal.fd < 0) {
+		return;
+	}
+
+	set_symtab_hook(NULL);
+	pthread_mutex_lock(&wal.lock);
+	write_checkpoint();
+	wal.stop = 1;
+	pthread_cond_signal(&wal.wake);
+	pthread_mutex_unlock(&wal.lock);
+	pthread_join(wal.syncer, NULL);
+
+	close(wal.fd);
+	wal.fd = -1;
+	free(wal.log_path);
+	free(wal.checkpoint_path);
+	free(wal.temp_path);
+	free(wal.buf);
+	wal.buf = NULL;
+	wal.len = wal.cap = 0;
+}
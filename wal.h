@@ -0,0 +1,60 @@
+/// Write-ahead log and checkpoints of the symbol table
+///
+/// With --wal DIR every change to the symbol table is appended to
+/// DIR/log as it is made, and the whole table is periodically written
+/// to DIR/checkpoint.  After a crash, restarting with the same --wal
+/// loads the checkpoint and replays only the log records written after
+/// it, so recovery takes time proportional to the tail of the log, not
+/// the length of the session.
+///
+/// Log records (all integers little endian):
+///
+///     crc:u32 seq:u64 val:i32 len:u32 name:len bytes
+///
+/// The CRC-32 covers everything after it.  Sequence numbers increase
+/// by one per record; a record that is cut short, fails its CRC or
+/// breaks the sequence ends the log (it was being written during the
+/// crash) and is truncated away on recovery.
+///
+/// The checkpoint is a symbol table file that build_table can read,
+/// in insertion order, preceded by a comment holding the sequence
+/// number of the last record it includes.  It is written to a
+/// temporary file and renamed into place, so there is always one
+/// complete checkpoint.
+///
+/// Records reach the log file with one write per input line (so a
+/// crash of the process loses nothing), and are synced to disk at most
+/// once every WAL_SYNC_MS (so a crash of the machine loses at most that
+/// much input).
+
+#ifndef WAL_H
+#define WAL_H
+
+#define WAL_SYNC_MS 20                  // longest time between syncs of the log
+#define WAL_CHECKPOINT_RECORDS 1000000  // default log records between checkpoints
+
+/// Opens the log in a directory, creating the directory if needed.
+/// If it holds a checkpoint or log, the symbol table is rebuilt from
+/// them and the table file is not read.  Otherwise the table file (if
+/// any) is loaded and becomes the first checkpoint.  From then on every
+/// change to the table is logged.
+/// @param dir  the directory holding the checkpoint and log
+/// @param table  the symbol table file, or NULL for an empty table
+/// @param checkpoint_every  log records between checkpoints
+/// @return 1 if the table was recovered from the directory, 0 otherwise
+/// @exception If the directory, checkpoint or log can't be read or
+///     written, an error message is displayed and the program exits
+///     with EXIT_FAILURE.
+int wal_open(char *dir, char *table, unsigned long long checkpoint_every);
+
+/// Ends a group of changes (one input line).  Writes the records of the
+/// group to the log, syncs the log if WAL_SYNC_MS has passed since the
+/// last sync, and writes a checkpoint if enough records have built up.
+/// Does nothing if no log is open.
+void wal_commit(void);
+
+/// Writes a final checkpoint, empties the log and closes it.  Does
+/// nothing if no log is open.
+void wal_close(void);
+
+#endif